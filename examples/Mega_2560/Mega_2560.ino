@@ -18,6 +18,7 @@ byte mac[] = {
 namespace
 {
     BalBoa::BalBoaSpa Spa;
+    BalBoa::SpaStatus lastStatus = BalBoa::ssIdle;
 }
 
 void 
@@ -41,7 +42,8 @@ setup()
     }
     //  Default is to retrieve updates from the spa every 60 seconds.  ALL data is
     //  initially marked as 'changed', so you shouldn't need to have special
-    //  initialization code.
+    //  initialization code.  begin() only starts looking for the spa, it returns
+    //  straight away and GetChanges() does the rest.
     Spa.begin();
 
 }
@@ -140,12 +142,13 @@ loop()
         Serial.println(F("Panel Message!"));
     }
  
-    if (!Spa)
+    //  Finding the spa, connecting, and re-establishing communications when spa
+    //  networking gets flakey all happen inside GetChanges(), without blocking.
+    BalBoa::SpaStatus status = Spa.GetStatus();
+
+    if (status != lastStatus)
     {
-        //  Spa networking can be kind of flakey.  This check will try to re-establish 
-        //  communications if the spa isn't responding.
-     
-        //  Again, using default of updates every 60 seconds.
-        Spa.begin();
+        Serial.print(F("Spa status: ")), Serial.println((int)status);
+        lastStatus = status;
     }
 }
@@ -0,0 +1,152 @@
+//  Host micro-benchmark for the Balboa check byte.  Compares the bit-at-a-time
+//  calculation, the single 256 byte table used on the micro-controllers, and the
+//  slice-by-4 kernel that src/crc.c uses on the host.
+//
+//  Built by the host CMake build (see README.md), run with no arguments.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "crc.h"
+
+namespace
+{
+	//  Same algorithm as F_CRC_ObtenValorDeTabla(), run for every byte.
+	uint8_t CrcBitwise(const uint8_t *pData, size_t count)
+	{
+		uint8_t value = INITIAL_VALUE;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			value ^= pData[i];
+
+			for (int bit = 0; bit < 8; bit++)
+			{
+				value = (value & 0x80) ? (uint8_t)((value << 1) ^ POLYNOMIAL) : (uint8_t)(value << 1);
+			}
+		}
+
+		return value ^ FINAL_XOR_VALUE;
+	}
+
+
+	uint8_t Table[256];
+
+	void BuildTable()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			uint8_t value = (uint8_t)i;
+
+			for (int bit = 0; bit < 8; bit++)
+			{
+				value = (value & 0x80) ? (uint8_t)((value << 1) ^ POLYNOMIAL) : (uint8_t)(value << 1);
+			}
+			Table[i] = value;
+		}
+	}
+
+	//  What the Arduino builds run (CRC_SLICE_BY 1).
+	uint8_t CrcTable(const uint8_t *pData, size_t count)
+	{
+		uint8_t value = INITIAL_VALUE;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			value = Table[value ^ pData[i]];
+		}
+
+		return value ^ FINAL_XOR_VALUE;
+	}
+
+	//  Library build for this host.
+	uint8_t CrcLibrary(const uint8_t *pData, size_t count)
+	{
+		return F_CRC_CalculaCheckSum(pData, (uint16_t)count);
+	}
+
+
+	typedef uint8_t (*CrcFunction)(const uint8_t *, size_t);
+
+	volatile uint8_t sink;
+
+	double NsPerByte(CrcFunction function, const std::vector<uint8_t> &data, size_t frameLength)
+	{
+		const size_t frames = data.size() / frameLength;
+		const int passes = 200;
+
+		auto tStart = std::chrono::steady_clock::now();
+
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (size_t frame = 0; frame < frames; frame++)
+			{
+				sink = function(data.data() + frame * frameLength, frameLength);
+			}
+		}
+
+		auto tEnd = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(tEnd - tStart).count();
+
+		return ns / ((double)passes * frames * frameLength);
+	}
+}
+
+
+int main()
+{
+	BuildTable();
+
+	const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+	if ((CrcBitwise(check, sizeof(check)) != CHECK_VALUE)
+		|| (CrcTable(check, sizeof(check)) != CHECK_VALUE)
+		|| (CrcLibrary(check, sizeof(check)) != CHECK_VALUE))
+	{
+		fprintf(stderr, "Check value mismatch!\n");
+		return 1;
+	}
+
+	std::vector<uint8_t> data(1 << 16);
+	srand(1);
+	for (auto &b : data)
+	{
+		b = (uint8_t)rand();
+	}
+
+	//  A status frame covers 27 bytes (length through payload), longest frame is ~38.
+	const size_t frameLengths[] = {5, 27, 38, 1024};
+
+	for (size_t frameLength : frameLengths)
+	{
+		for (size_t offset = 0; offset + frameLength <= 4096; offset += frameLength)
+		{
+			uint8_t expected = CrcBitwise(data.data() + offset, frameLength);
+
+			if ((CrcTable(data.data() + offset, frameLength) != expected)
+				|| (CrcLibrary(data.data() + offset, frameLength) != expected))
+			{
+				fprintf(stderr, "Kernel mismatch at length %zu!\n", frameLength);
+				return 1;
+			}
+		}
+	}
+
+	printf("%-8s %12s %12s %12s\n", "bytes", "bitwise", "table", "library");
+
+	for (size_t frameLength : frameLengths)
+	{
+		printf("%-8zu %9.3f ns %9.3f ns %9.3f ns\n", frameLength,
+			   NsPerByte(CrcBitwise, data, frameLength),
+			   NsPerByte(CrcTable, data, frameLength),
+			   NsPerByte(CrcLibrary, data, frameLength));
+	}
+
+	printf("library kernel: CRC_SLICE_BY %d\n", CRC_SLICE_BY);
+
+	return 0;
+}
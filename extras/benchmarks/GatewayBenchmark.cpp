@@ -0,0 +1,220 @@
+//  Load test for the epoll gateway (BalBoaGateway.h), run against SpaSimulator.
+//
+//  Usage:  GatewayBenchmark [-n spas] [-t threads] [-s seconds] [-a first-address]
+//                           [-o output.json]
+//
+//  Start the simulator first with at least as many spas, and a short cadence for more
+//  load, e.g.
+//
+//      SpaSimulator -n 2000 -c 50 &
+//      GatewayBenchmark -n 2000 -t 4 -s 10
+//
+//  Once every spa is connected (or after 10 seconds), frames and CPU time (user + system,
+//  this process only) are measured over the run.  Reported are frames per second, CPU
+//  per frame, cores busy (CPU time / wall time) and connections per core (connections /
+//  cores busy).  Results are written as JSON, like SpaBenchmark.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include <BalBoaSpa.h>
+#include <BalBoaGateway.h>
+
+using namespace BalBoa;
+
+namespace
+{
+	struct Options
+	{
+		unsigned int spaCount = 100;
+		unsigned int threads = 1;
+		unsigned int seconds = 10;
+		uint32_t firstAddress = 0x7f000101;  //  127.0.1.1, host order
+		const char *pOutput = nullptr;
+	} options;
+
+
+	double CpuSeconds()
+	{
+		rusage usage;
+
+		getrusage(RUSAGE_SELF, &usage);
+
+		return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+			+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	}
+
+
+	//  Acknowledges everything, as an application repainting its view would.
+	void OnChanges(GatewaySpa &spa, void *)
+	{
+		spa.GetSpaTime();
+		spa.GetSpaTemp();
+		spa.GetSetTemp();
+		spa.IsRecirc();
+		spa.GetPump1Speed();
+		spa.GetPump2Speed();
+		spa.GetFilterInfo();
+		spa.GetRunningFilter();
+		spa.IsHeating();
+		spa.IsLightOn();
+		spa.GetVersion();
+		spa.GetPanelMessages();
+		spa.IsPriming();
+	}
+
+
+	bool ParseOptions(int argc, char *argv[])
+	{
+		int option;
+
+		while ((option = getopt(argc, argv, "n:t:s:a:o:")) != -1)
+		{
+			switch (option)
+			{
+			case 'n':
+				options.spaCount = (unsigned int)atoi(optarg);
+				break;
+
+			case 't':
+				options.threads = (unsigned int)atoi(optarg);
+				break;
+
+			case 's':
+				options.seconds = (unsigned int)atoi(optarg);
+				break;
+
+			case 'a':
+			{
+				in_addr address;
+
+				if (inet_aton(optarg, &address) == 0)
+				{
+					return false;
+				}
+				options.firstAddress = ntohl(address.s_addr);
+				break;
+			}
+
+			case 'o':
+				options.pOutput = optarg;
+				break;
+
+			default:
+				return false;
+			}
+		}
+
+		return (options.spaCount > 0) && (options.seconds > 0);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (!ParseOptions(argc, argv))
+	{
+		fprintf(stderr, "Usage: %s [-n spas] [-t threads] [-s seconds] [-a first-address] "
+				"[-o output.json]\n", argv[0]);
+		return 1;
+	}
+
+	//  Each spa needs a socket.
+	rlimit limit;
+
+	if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < options.spaCount + 64))
+	{
+		limit.rlim_cur = min((rlim_t)options.spaCount + 64, limit.rlim_max);
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	SpaGateway gateway;
+
+	//  Same addresses as SpaSimulator hands out, skipping .0 and .255.
+	uint32_t address = options.firstAddress;
+
+	for (unsigned int i = 0; i < options.spaCount; i++, address++)
+	{
+		while (((address & 0xff) == 0) || ((address & 0xff) == 0xff))
+		{
+			address++;
+		}
+
+		gateway.Add(IPAddress(htonl(address)));
+	}
+
+	gateway.SetChangeHandler(OnChanges, nullptr);
+
+	const unsigned long connectStart = millis();
+
+	if (!gateway.begin(options.threads))
+	{
+		fprintf(stderr, "Can't start gateway\n");
+		return 1;
+	}
+
+	while ((gateway.GetStats().connected < options.spaCount)
+		   && ((millis() - connectStart) < 10000))
+	{
+		usleep(10000);
+	}
+
+	const unsigned long connectTime = millis() - connectStart;
+
+	const SpaGateway::Stats before = gateway.GetStats();
+	const double cpuBefore = CpuSeconds();
+	const unsigned long start = millis();
+
+	sleep(options.seconds);
+
+	const SpaGateway::Stats after = gateway.GetStats();
+	const double cpu = CpuSeconds() - cpuBefore;
+	const double wall = (millis() - start) / 1000.0;
+
+	const unsigned int threads = gateway.Threads();
+	gateway.end();
+
+	const unsigned long long frames = after.frames - before.frames;
+	const double coresBusy = cpu / wall;
+
+	FILE *pFile = options.pOutput ? fopen(options.pOutput, "w") : stdout;
+
+	if (pFile == nullptr)
+	{
+		perror(options.pOutput);
+		return 1;
+	}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "  \"suite\": \"BalBoaGateway\",\n");
+	fprintf(pFile, "  \"config\": {\n");
+	fprintf(pFile, "    \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(pFile, "    \"spas\": %u,\n", options.spaCount);
+	fprintf(pFile, "    \"threads\": %u,\n", threads);
+	fprintf(pFile, "    \"seconds\": %u,\n", options.seconds);
+	fprintf(pFile, "    \"tick_ms\": %d\n", BALBOA_GATEWAY_TICK);
+	fprintf(pFile, "  },\n");
+	fprintf(pFile, "  \"results\": {\n");
+	fprintf(pFile, "    \"connected\": %lu,\n", after.connected);
+	fprintf(pFile, "    \"connect_ms\": %lu,\n", connectTime);
+	fprintf(pFile, "    \"frames\": %llu,\n", frames);
+	fprintf(pFile, "    \"frames_per_sec\": %.0f,\n", frames / wall);
+	fprintf(pFile, "    \"bytes_per_sec\": %.0f,\n", (after.bytes - before.bytes) / wall);
+	fprintf(pFile, "    \"cpu_us_per_frame\": %.3f,\n", frames ? cpu * 1e6 / frames : 0.0);
+	fprintf(pFile, "    \"cores_busy\": %.3f,\n", coresBusy);
+	fprintf(pFile, "    \"connections_per_core\": %.0f,\n", (coresBusy > 0) ? after.connected / coresBusy : 0.0);
+	fprintf(pFile, "    \"connect_failures\": %lu,\n", after.connectFailures);
+	fprintf(pFile, "    \"timeouts\": %lu\n", after.timeouts);
+	fprintf(pFile, "  }\n");
+	fprintf(pFile, "}\n");
+
+	if (pFile != stdout)
+	{
+		fclose(pFile);
+	}
+
+	return 0;
+}
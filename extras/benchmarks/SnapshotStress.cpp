@@ -0,0 +1,227 @@
+//  Stress test for the state snapshots (BalBoaSnapshot.h):  one writer and several
+//  readers of GetState() at once, checking that no reader ever sees half an update.
+//
+//  Usage:  SnapshotStress [-r readers] [-s seconds] [-o output.json]
+//
+//  The writer feeds the protocol code two status frames, alternately, as fast as it can.
+//  The frames differ in every field that's checked, so each copy a reader gets has to
+//  match one frame or the other throughout; anything else is counted as torn.  The
+//  update count must never go backwards either.
+//
+//  SnapshotStressControl is the same test built without snapshots (BALBOA_SNAPSHOT 0),
+//  where GetState() copies the live state.  It should find torn copies, which shows the
+//  test can.  Results are written as JSON, like SpaBenchmark; the exit code is 1 if
+//  snapshots are on and anything torn was seen.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <BalBoaSpa.h>
+#include <BalBoaMessages.h>
+#include "crc.h"
+
+using namespace BalBoa;
+
+namespace
+{
+	struct Options
+	{
+		unsigned int readers = 3;
+		unsigned int seconds = 3;
+		const char *pOutput = nullptr;
+	} options;
+
+
+	//  Decodes, and nothing to send to.
+	class MemorySpa : public SpaProtocol
+	{
+	protected:
+		void SendMessage(MessageBase *) override
+		{
+		}
+	};
+
+
+	//  Two states to alternate between:  temperature and set point, minute, lights and
+	//  pump 1 all differ.
+	struct Frame
+	{
+		byte temp;
+		byte minute;
+		bool lights;
+		PumpSpeed pump1;
+		std::vector<byte> bytes;
+	};
+
+	Frame MakeFrame(byte temp, byte minute, bool lights, PumpSpeed pump1)
+	{
+		typedef StatusPayload Status;
+
+		Frame frame = {temp, minute, lights, pump1, {}};
+		byte payload[Status::length] = {};
+
+		Status::CurrentTemp::Set(payload, temp);
+		Status::SetTemp::Set(payload, temp);
+		Status::Hour::Set(payload, 12);
+		Status::Minute::Set(payload, minute);
+		Status::Light::Set(payload, lights ? 3 : 0);
+		Status::Pump1::Set(payload, pump1);
+
+		frame.bytes.push_back(0x7e);
+		frame.bytes.push_back((byte)(Status::length + 5));
+		frame.bytes.push_back((byte)msStatus);
+		frame.bytes.push_back((byte)(msStatus >> 8));
+		frame.bytes.push_back((byte)(msStatus >> 16));
+		frame.bytes.insert(frame.bytes.end(), payload, payload + Status::length);
+		frame.bytes.push_back(F_CRC_CalculaCheckSum(frame.bytes.data() + 1, Status::length + 4));
+		frame.bytes.push_back(0x7e);
+
+		return frame;
+	}
+
+	bool Matches(const SpaState &state, const Frame &frame)
+	{
+		return (state.currentTemp.temp == frame.temp)
+			&& (state.setPoint.temp == frame.temp)
+			&& (state.time.minute == frame.minute)
+			&& ((state.lights == tsTrue) == frame.lights)
+			&& (state.pump1 == frame.pump1);
+	}
+
+
+	bool ParseOptions(int argc, char *argv[])
+	{
+		int option;
+
+		while ((option = getopt(argc, argv, "r:s:o:")) != -1)
+		{
+			switch (option)
+			{
+			case 'r':
+				options.readers = (unsigned int)atoi(optarg);
+				break;
+
+			case 's':
+				options.seconds = (unsigned int)atoi(optarg);
+				break;
+
+			case 'o':
+				options.pOutput = optarg;
+				break;
+
+			default:
+				return false;
+			}
+		}
+
+		return (options.readers > 0) && (options.seconds > 0);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (!ParseOptions(argc, argv))
+	{
+		fprintf(stderr, "Usage:  %s [-r readers] [-s seconds] [-o output.json]\n", argv[0]);
+		return 2;
+	}
+
+	const Frame frames[2] = {MakeFrame(100, 10, true, psHigh), MakeFrame(80, 50, false, psOff)};
+
+	MemorySpa spa;
+	std::atomic<bool> stop(false);
+	std::atomic<unsigned long> reads(0), torn(0), backwards(0);
+	unsigned long writes = 0;
+
+	std::vector<std::thread> readers;
+
+	for (unsigned int i = 0; i < options.readers; i++)
+	{
+		readers.emplace_back([&]()
+		{
+			unsigned long myReads = 0, myTorn = 0, myBackwards = 0;
+			uint32_t lastUpdate = 0;
+
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				const SpaState state = spa.GetState();
+
+				if (state.updates < lastUpdate)
+				{
+					myBackwards++;
+				}
+				lastUpdate = state.updates;
+
+				//  Nothing decoded yet is fine, anything else must be one frame or the other.
+				if ((state.currentTemp.temp != UNKNOWN_VAL)
+					&& !Matches(state, frames[0]) && !Matches(state, frames[1]))
+				{
+					myTorn++;
+				}
+
+				myReads++;
+			}
+
+			reads += myReads;
+			torn += myTorn;
+			backwards += myBackwards;
+		});
+	}
+
+	const unsigned long start = millis();
+
+	while ((millis() - start) < options.seconds * 1000UL)
+	{
+		for (const Frame &frame : frames)
+		{
+			spa.Receive(frame.bytes.data(), frame.bytes.size());
+			writes++;
+		}
+	}
+
+	stop = true;
+
+	for (std::thread &reader : readers)
+	{
+		reader.join();
+	}
+
+	FILE *pFile = stdout;
+
+	if (options.pOutput)
+	{
+		pFile = fopen(options.pOutput, "w");
+
+		if (pFile == nullptr)
+		{
+			perror(options.pOutput);
+			return 2;
+		}
+	}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "  \"suite\": \"SnapshotStress\",\n");
+	fprintf(pFile, "  \"config\": {\n");
+	fprintf(pFile, "    \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(pFile, "    \"snapshot\": %d,\n", BALBOA_SNAPSHOT);
+	fprintf(pFile, "    \"readers\": %u,\n", options.readers);
+	fprintf(pFile, "    \"seconds\": %u\n", options.seconds);
+	fprintf(pFile, "  },\n");
+	fprintf(pFile, "  \"writes\": %lu,\n", writes);
+	fprintf(pFile, "  \"reads\": %lu,\n", reads.load());
+	fprintf(pFile, "  \"torn\": %lu,\n", torn.load());
+	fprintf(pFile, "  \"updates_backwards\": %lu\n", backwards.load());
+	fprintf(pFile, "}\n");
+
+	if (pFile != stdout)
+	{
+		fclose(pFile);
+	}
+
+	return (BALBOA_SNAPSHOT && (torn || backwards)) ? 1 : 0;
+}
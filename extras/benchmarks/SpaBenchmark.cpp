@@ -0,0 +1,573 @@
+//  Host benchmark suite for the library's hot paths:  check byte calculation, the
+//  receive loop, status message decoding, field access, command encoding and idle
+//  polling.  Results
+//  are written as JSON so they can be compared between releases.
+//
+//  Usage:  SpaBenchmark [output.json]      (default is stdout)
+//
+//  Everything runs from memory, no network.  Each figure is the median of several
+//  timed repetitions after a warm-up pass, and all input data is generated from fixed
+//  seeds, so runs on the same machine and build are directly comparable.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <BalBoaSpa.h>
+#include <BalBoaMessages.h>
+#include <BalBoaLog.h>
+#include "crc.h"
+
+using namespace BalBoa;
+
+namespace
+{
+	//  Stands in for the TCP client:  hands out a prepared byte stream in chunks no
+	//  larger than a typical socket read.
+	class MemoryClient
+	{
+	public:
+		MemoryClient(const std::vector<byte> &data, size_t chunk)
+			: _pData(data.data()), _remaining(data.size()), _chunk(chunk)
+		{
+		}
+
+		int available() const
+		{
+			return (int)min(_remaining, _chunk);
+		}
+
+		int read(byte *pBuffer, size_t size)
+		{
+			size = min(size, _remaining);
+			memcpy(pBuffer, _pData, size);
+			_pData += size;
+			_remaining -= size;
+
+			return (int)size;
+		}
+
+	private:
+		const byte *_pData;
+		size_t _remaining;
+		size_t _chunk;
+	};
+
+
+	//  The protocol engine with its output going to memory.
+	class MemorySpa : public SpaProtocol
+	{
+	public:
+		unsigned int Poll(MemoryClient &client)
+		{
+			ReceiveFrom(client);
+
+			return _changes;
+		}
+
+		void Decode(const byte *pPayload, bool full)
+		{
+			DecodeStatus(pPayload, full);
+		}
+
+		void ClearWaiting()
+		{
+			_waitingForMessages = 0;
+		}
+
+		size_t BytesSent() const
+		{
+			return _bytesSent;
+		}
+
+	protected:
+		void SendMessage(MessageBase *pMessage) override
+		{
+			pMessage->SetCRC();
+
+			const size_t size = pMessage->_length + 2;
+
+			memcpy(_sent, pMessage, size);
+			_bytesSent += size;
+		}
+
+	private:
+		byte _sent[64];
+		size_t _bytesSent = 0;
+	};
+
+
+	//  A status frame as a real spa sends it, 'minute' lets frames differ.
+	void AppendFrame(std::vector<byte> &stream, uint32_t messageType, const byte *pPayload,
+					 size_t payloadSize)
+	{
+		const size_t start = stream.size();
+
+		stream.push_back(0x7e);
+		stream.push_back((byte)(payloadSize + 5));
+		stream.push_back((byte)messageType);
+		stream.push_back((byte)(messageType >> 8));
+		stream.push_back((byte)(messageType >> 16));
+		stream.insert(stream.end(), pPayload, pPayload + payloadSize);
+		stream.push_back(F_CRC_CalculaCheckSum(stream.data() + start + 1, (uint16_t)(payloadSize + 4)));
+		stream.push_back(0x7e);
+	}
+
+	const byte statusPayload[SpaProtocol::statusPayloadLength] =
+	{
+		0x14, 0x00, 0x62, 0x0c, 0x1e, 0x00, 0x00, 0x02, 0x00, 0x00, 0x04, 0x00,
+		0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x00, 0x00, 0x00
+	};
+
+	std::vector<byte> StatusStream(size_t frames, bool changing, uint32_t messageType = msStatus)
+	{
+		std::vector<byte> stream;
+		byte payload[sizeof(statusPayload)];
+
+		memcpy(payload, statusPayload, sizeof(payload));
+
+		for (size_t i = 0; i < frames; i++)
+		{
+			if (changing)
+			{
+				payload[4] = (byte)(i % 60);       //  minute
+				payload[2] = (byte)(95 + i % 8);   //  current temp
+			}
+
+			AppendFrame(stream, messageType, payload, sizeof(payload));
+		}
+
+		return stream;
+	}
+
+
+	struct Result
+	{
+		const char *name;
+		const char *op;
+		double nsPerOp;
+	};
+
+	std::vector<Result> results;
+
+	constexpr int repetitions = 9;
+
+	//  'body' performs 'ops' operations per call.
+	void Measure(const char *name, const char *op, size_t ops, const std::function<void()> &body)
+	{
+		std::vector<double> times;
+
+		body();  //  Warm-up
+
+		for (int i = 0; i < repetitions; i++)
+		{
+			auto tStart = std::chrono::steady_clock::now();
+
+			body();
+
+			auto tEnd = std::chrono::steady_clock::now();
+
+			times.push_back(std::chrono::duration<double, std::nano>(tEnd - tStart).count() / ops);
+		}
+
+		std::sort(times.begin(), times.end());
+		results.push_back({name, op, times[repetitions / 2]});
+	}
+
+
+	volatile unsigned int sink;
+
+
+	void BenchmarkCRC()
+	{
+		std::vector<byte> data(1 << 16);
+
+		srand(1);
+		for (auto &b : data)
+		{
+			b = (byte)rand();
+		}
+
+		const struct
+		{
+			const char *name;
+			size_t length;
+		} lengths[] = {{"crc.status_frame", 28}, {"crc.1k", 1024}};
+
+		for (const auto &length : lengths)
+		{
+			const size_t frames = data.size() / length.length;
+
+			Measure(length.name, "byte", frames * length.length * 20, [&]()
+			{
+				for (int pass = 0; pass < 20; pass++)
+				{
+					for (size_t frame = 0; frame < frames; frame++)
+					{
+						sink = F_CRC_CalculaCheckSum(data.data() + frame * length.length,
+													 (uint16_t)length.length);
+					}
+				}
+			});
+		}
+	}
+
+
+	void BenchmarkReceive()
+	{
+		constexpr size_t frames = 8192;
+
+		const std::vector<byte> unchanged = StatusStream(frames, false);
+		const std::vector<byte> changing = StatusStream(frames, true);
+
+		//  Same length, but a message ID that's accepted and ignored:  the cost of
+		//  framing and dispatch without any decoding.
+		const std::vector<byte> ignored = StatusStream(frames, false, msSetTempRange);
+
+		MemorySpa spa;
+
+		const struct
+		{
+			const char *name;
+			const std::vector<byte> &stream;
+			size_t chunk;
+		} streams[] =
+		{
+			{"receive.status_unchanged", unchanged, 1460},
+			{"receive.status_changing", changing, 1460},
+			{"receive.status_changing.byte_reads", changing, 1},
+			{"receive.ignored_frame", ignored, 1460},
+		};
+
+		for (const auto &stream : streams)
+		{
+			Measure(stream.name, "frame", frames, [&]()
+			{
+				MemoryClient client(stream.stream, stream.chunk);
+
+				while (client.available())
+				{
+					sink = spa.Poll(client);
+				}
+			});
+		}
+	}
+
+
+	//  The status payload as packed bitfields, the way it was described before the wire
+	//  schema, for comparison.  Bitfield order is the compiler's choice; this is how GCC
+	//  lays them out, which is what the library used to rely on.
+	struct LegacyStatus
+	{
+		byte _r1;
+		byte _priming : 1;
+		byte : 0;
+		byte _currentTemp;
+		byte _hour;
+		byte _minute;
+		byte _heatingMode : 2;
+		byte : 0;
+		byte _panelMessage : 4;
+		byte : 0;
+		byte _r2;
+		byte _holdTime;
+		byte _tempScaleCelsius : 1;
+		byte _24hrTime : 1;
+		byte _filter1Running : 1;
+		byte _filter2Running : 1;
+		byte : 0;
+		byte _r3 : 2;
+		byte _tempRange : 1;
+		byte _r4 : 1;
+		byte _heating : 2;
+		byte : 0;
+		byte _pump1 : 2;
+		byte _pump2 : 2;
+		byte : 0;
+		byte _r5;
+		byte _r6 : 1;
+		byte _circPump : 1;
+		byte : 0;
+		byte _light : 2;
+		byte : 0;
+		byte _r7[3];
+		byte _r7a : 1;
+		byte _timeUnset : 1;
+		byte : 0;
+		byte _r7b;
+		byte _setTemp;
+		byte _r8 : 2;
+		byte _systemHold : 1;
+		byte : 0;
+		byte _r9[2];
+	} __attribute__((packed));
+
+	static_assert(sizeof(LegacyStatus) == StatusPayload::length, "Legacy status layout");
+
+
+	void BenchmarkDecode()
+	{
+		//  The status decoder on its own, no framing or check byte:  skipping unchanged
+		//  messages, decoding only the fields that changed, and decoding everything.
+		{
+			constexpr size_t count = 8192;
+
+			std::vector<byte> changing(count * sizeof(statusPayload));
+
+			for (size_t i = 0; i < count; i++)
+			{
+				byte *pPayload = changing.data() + i * sizeof(statusPayload);
+
+				memcpy(pPayload, statusPayload, sizeof(statusPayload));
+				pPayload[4] = (byte)(i % 60);       //  minute
+				pPayload[2] = (byte)(95 + i % 8);   //  current temp
+			}
+
+			const struct
+			{
+				const char *name;
+				size_t stride;
+				bool full;
+			} decodes[] =
+			{
+				{"decode.status_unchanged", 0, false},
+				{"decode.status_changing", sizeof(statusPayload), false},
+				{"decode.status_changing.all_fields", sizeof(statusPayload), true},
+			};
+
+			MemorySpa spa;
+
+			for (const auto &decode : decodes)
+			{
+				Measure(decode.name, "payload", count, [&]()
+				{
+					for (size_t i = 0; i < count; i++)
+					{
+						spa.Decode(changing.data() + i * decode.stride, decode.full);
+					}
+
+					sink = spa.Changes();
+				});
+			}
+		}
+
+		constexpr size_t payloads = 4096;
+
+		//  Every field read from each payload, varied so nothing can be hoisted.
+		std::vector<byte> data(payloads * StatusPayload::length);
+
+		srand(2);
+		for (auto &b : data)
+		{
+			b = (byte)rand();
+		}
+
+		Measure("decode.status_fields.bitfields", "payload", payloads * 20, [&]()
+		{
+			unsigned int total = 0;
+
+			for (int pass = 0; pass < 20; pass++)
+			{
+				for (size_t i = 0; i < payloads; i++)
+				{
+					const LegacyStatus *pStatus = (const LegacyStatus *)(data.data() + i * StatusPayload::length);
+
+					total += pStatus->_priming + pStatus->_currentTemp + pStatus->_hour + pStatus->_minute +
+						pStatus->_heatingMode + pStatus->_panelMessage + pStatus->_holdTime +
+						pStatus->_tempScaleCelsius + pStatus->_24hrTime + pStatus->_filter1Running +
+						pStatus->_filter2Running + pStatus->_tempRange + pStatus->_heating +
+						pStatus->_pump1 + pStatus->_pump2 + pStatus->_circPump + pStatus->_light +
+						pStatus->_timeUnset + pStatus->_setTemp + pStatus->_systemHold;
+				}
+			}
+
+			sink = total;
+		});
+
+		Measure("decode.status_fields.schema", "payload", payloads * 20, [&]()
+		{
+			typedef StatusPayload Status;
+			unsigned int total = 0;
+
+			for (int pass = 0; pass < 20; pass++)
+			{
+				for (size_t i = 0; i < payloads; i++)
+				{
+					const byte *pPayload = data.data() + i * StatusPayload::length;
+
+					total += Status::Priming::Get(pPayload) + Status::CurrentTemp::Get(pPayload) +
+						Status::Hour::Get(pPayload) + Status::Minute::Get(pPayload) +
+						Status::HeatingMode::Get(pPayload) + Status::PanelMessage::Get(pPayload) +
+						Status::HoldTime::Get(pPayload) + Status::TempScaleCelsius::Get(pPayload) +
+						Status::Display24Hr::Get(pPayload) + Status::Filter1Running::Get(pPayload) +
+						Status::Filter2Running::Get(pPayload) + Status::TempRange::Get(pPayload) +
+						Status::Heating::Get(pPayload) + Status::Pump1::Get(pPayload) +
+						Status::Pump2::Get(pPayload) + Status::CircPump::Get(pPayload) +
+						Status::Light::Get(pPayload) + Status::TimeUnset::Get(pPayload) +
+						Status::SetTemp::Get(pPayload) + Status::SystemHold::Get(pPayload);
+				}
+			}
+
+			sink = total;
+		});
+
+		//  Message ID to handler index, for every ID a spa sends and one it doesn't.
+		const uint32_t ids[] = {msStatus, msConfigResponse, msFilterConfig, msControlConfig,
+								msControlConfig2, msSetTempRange, 0x10bf13};
+		constexpr size_t lookups = 1000000;
+
+		Measure("decode.message_index", "lookup", lookups, [&]()
+		{
+			unsigned int total = 0;
+
+			for (size_t i = 0; i < lookups; i++)
+			{
+				total += SpaMessage(ids[i % (sizeof(ids) / sizeof(ids[0]))]);
+			}
+
+			sink = total;
+		});
+	}
+
+
+	void BenchmarkSend()
+	{
+		constexpr size_t count = 100000;
+
+		MemorySpa spa;
+
+		//  Need to know the temperature scale before it can be toggled.
+		std::vector<byte> status = StatusStream(1, false);
+		MemoryClient client(status, status.size());
+		spa.Poll(client);
+
+		const SpaTime time = {12, 30, true};
+		const SpaTemp temp = {100, false};
+
+		const struct
+		{
+			const char *name;
+			std::function<void()> send;
+		} messages[] =
+		{
+			{"send.toggle_lights", [&]() { spa.ToggleLights(); }},
+			{"send.toggle_pump1", [&]() { spa.TogglePump1(); }},
+			{"send.toggle_temp_range", [&]() { spa.ToggleTempRange(); }},
+			{"send.toggle_temp_scale", [&]() { spa.ToggleTempScale(); }},
+			{"send.set_temp", [&]() { spa.SetTemp(temp); }},
+			{"send.set_time", [&]() { spa.SetTime(time); }},
+			{"send.filter_config_request", [&]() { spa.ClearWaiting(); spa.SendFilterConfigRequest(); }},
+		};
+
+		for (const auto &message : messages)
+		{
+			Measure(message.name, "message", count, [&]()
+			{
+				for (size_t i = 0; i < count; i++)
+				{
+					message.send();
+				}
+			});
+		}
+
+		sink = (unsigned int)spa.BytesSent();
+	}
+
+
+	void BenchmarkIdle()
+	{
+		constexpr size_t count = 1000000;
+
+		//  Connected, nothing waiting.
+		MemorySpa spa;
+		std::vector<byte> empty;
+
+		Measure("idle.receive_no_data", "call", count, [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				MemoryClient client(empty, 1460);
+
+				sink = spa.Poll(client);
+			}
+		});
+
+		//  The full BalBoaSpa::GetChanges(), no spa found yet.
+		BalBoaSpa network;
+
+		network.setPollingInterval(0);
+
+		Measure("idle.get_changes_no_spa", "call", count, [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				sink = network.GetChanges();
+			}
+		});
+	}
+
+
+	void WriteJSON(FILE *pFile)
+	{
+		fprintf(pFile, "{\n");
+		fprintf(pFile, "  \"suite\": \"BalBoaSpa\",\n");
+		fprintf(pFile, "  \"config\": {\n");
+		fprintf(pFile, "    \"compiler\": \"%s\",\n", __VERSION__);
+		fprintf(pFile, "    \"crc_slice_by\": %d,\n", CRC_SLICE_BY);
+		fprintf(pFile, "    \"log_level\": %d,\n", BALBOA_LOG_LEVEL);
+		fprintf(pFile, "    \"trace_size\": %d,\n", BALBOA_TRACE_SIZE);
+		fprintf(pFile, "    \"analyzer\": %d,\n", BALBOA_ANALYZER);
+		fprintf(pFile, "    \"repetitions\": %d\n", repetitions);
+		fprintf(pFile, "  },\n");
+		fprintf(pFile, "  \"results\": [\n");
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Result &result = results[i];
+
+			fprintf(pFile, "    {\"name\": \"%s\", \"op\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+					result.name, result.op, result.nsPerOp, 1e9 / result.nsPerOp,
+					(i + 1 < results.size()) ? "," : "");
+		}
+
+		fprintf(pFile, "  ]\n");
+		fprintf(pFile, "}\n");
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	FILE *pFile = stdout;
+
+	if (argc > 1)
+	{
+		pFile = fopen(argv[1], "w");
+
+		if (pFile == nullptr)
+		{
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	BenchmarkCRC();
+	BenchmarkReceive();
+	BenchmarkDecode();
+	BenchmarkSend();
+	BenchmarkIdle();
+
+	WriteJSON(pFile);
+
+	if (pFile != stdout)
+	{
+		fclose(pFile);
+	}
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+//  Linux equivalent of the example sketches:  find the spa, and print what changes.
+//
+//  Usage:  SpaMonitor [local-ip [polling-interval-ms [cache-file]]]
+//
+//  Discovery broadcasts to the /24 around local-ip; the default is the first
+//  non-loopback interface.  Use 127.0.0.1 to talk to the spa simulator.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <BalBoaSpa.h>
+
+namespace
+{
+	BalBoa::BalBoaSpa Spa;
+
+	void PrintTime(const char *pLabel, const BalBoa::SpaTime &time)
+	{
+		printf("%s%02d:%02d", pLabel, time.hour, time.minute);
+	}
+
+
+	//  Called by the library as each change is decoded; prints the old and new values.
+	void OnChange(BalBoa::SpaChanges change, const BalBoa::SpaState &before,
+				  const BalBoa::SpaState &after, void *)
+	{
+		switch (change)
+		{
+		case BalBoa::scTime:
+			PrintTime("Time: ", before.time);
+			PrintTime(" -> ", after.time);
+			printf("\n");
+			break;
+
+		case BalBoa::scTemp:
+			printf("Temp: %d -> %d%s\n", before.currentTemp.temp, after.currentTemp.temp,
+				   after.currentTemp.isCelsiusX2 ? " (C x 2)" : "");
+			break;
+
+		case BalBoa::scSetPoint:
+			printf("Set point: %d -> %d, high range: %d\n",
+				   before.setPoint.temp, after.setPoint.temp, after.highRange);
+			break;
+
+		case BalBoa::scPump1:
+			printf("Pump 1: %d -> %d\n", before.pump1, after.pump1);
+			break;
+
+		case BalBoa::scPump2:
+			printf("Pump 2: %d -> %d\n", before.pump2, after.pump2);
+			break;
+
+		case BalBoa::scRecirc:
+			printf("Recirc: %d -> %d\n", before.recirc, after.recirc);
+			break;
+
+		case BalBoa::scHeating:
+			printf("Heating: %d -> %d\n", before.heating, after.heating);
+			break;
+
+		case BalBoa::scFilterTimes:
+		{
+			const BalBoa::FilterTimes &filter1 = after.filters._filter1;
+
+			PrintTime("Filter 1: ", filter1.stStart);
+			PrintTime(" for ", filter1.stDuration);
+			printf("\n");
+			break;
+		}
+
+		case BalBoa::scLights:
+			printf("Lights: %d -> %d\n", before.lights, after.lights);
+			break;
+
+		case BalBoa::scVersion:
+		{
+			const BalBoa::VersionInfo &vi = after.version;
+
+			printf("Version: %d.%d.%d '%s' signature %08X\n",
+				   vi._version[0], vi._version[1], vi._version[2], vi._name,
+				   (unsigned int)vi._signature);
+			break;
+		}
+
+		case BalBoa::scFilterRunning:
+			printf("Filter running: %d -> %d\n", before.runningFilter, after.runningFilter);
+			break;
+
+		case BalBoa::scPanelMessages:
+			printf("Panel messages: %02X -> %02X\n", before.panelMessages, after.panelMessages);
+			break;
+
+		case BalBoa::scPriming:
+			printf("Priming: %d -> %d\n", before.priming, after.priming);
+			break;
+
+		default:
+			break;
+		}
+
+		fflush(stdout);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned long pollingInterval = 60000;
+
+	if (argc > 1)
+	{
+		in_addr address;
+
+		if (inet_pton(AF_INET, argv[1], &address) != 1)
+		{
+			fprintf(stderr, "Bad address '%s'\n", argv[1]);
+			return 1;
+		}
+
+		BalBoa::HostNetwork.setLocalIP(IPAddress(address.s_addr));
+	}
+
+	if (argc > 2)
+	{
+		pollingInterval = strtoul(argv[2], nullptr, 0);
+	}
+
+	if (argc > 3)
+	{
+		BalBoa::CacheFile = argv[3];
+	}
+
+	Spa.SetChangeCallback(BalBoa::scMASK, OnChange);
+	Spa.begin(pollingInterval);
+
+	BalBoa::SpaStatus lastStatus = BalBoa::ssIdle;
+
+	for (;;)
+	{
+		//  Changes arrive through OnChange(), this just keeps things running.
+		Spa.GetChanges();
+
+		BalBoa::SpaStatus status = Spa.GetStatus();
+
+		if (status != lastStatus)
+		{
+			static const char *const statusNames[] = {"idle", "searching", "connecting", "connected", "disconnected"};
+			char buffer[INET_ADDRSTRLEN];
+
+			printf("Spa %s (%s)\n", statusNames[status], Spa.GetSpaIP().toString(buffer));
+			fflush(stdout);
+
+			lastStatus = status;
+		}
+
+		usleep(20000);
+	}
+}
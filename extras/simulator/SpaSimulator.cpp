@@ -0,0 +1,746 @@
+//  Simulates BalBoa 50350 Wi-Fi modules, so the library (and anything built on it) can be
+//  exercised without a hot-tub.  Linux only.
+//
+//  Each simulated spa gets its own loopback address (127.0.1.1, 127.0.1.2, ...) and
+//  listens on TCP port 4257 there.  A 'D' datagram to UDP port 30303 is answered once
+//  for every spa, each reply coming from that spa's address, just like a site full of
+//  real spas.  Connected clients get a status message every cadence period; config,
+//  filter and version requests are answered; toggles, set temp, set time and set scale
+//  commands change the simulated spa.
+//
+//  Usage:  SpaSimulator [-n spas] [-c cadence-ms] [-a first-address] [-p tcp-port]
+//                       [-d discovery-port] [-v]
+//
+//  Point the host build at it with local IP 127.0.0.1 (broadcast goes to 127.0.0.255).
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <vector>
+
+#include <BalBoaSpa.h>
+#include <BalBoaMessages.h>
+
+using namespace BalBoa;
+
+namespace
+{
+	struct Options
+	{
+		unsigned int spaCount = 1;
+		unsigned long cadence = 1000;
+		uint32_t firstAddress = 0x7f000101;  //  127.0.1.1, host order
+		uint16_t comPort = 4257;
+		uint16_t discoveryPort = 30303;
+		bool verbose = false;
+	} options;
+
+
+	//  What's on the far end of an epoll event.
+	enum HandlerKind : byte
+	{
+		hkDiscovery,
+		hkTimer,
+		hkListener,
+		hkConnection
+	};
+
+	struct Handler
+	{
+		HandlerKind kind;
+	};
+
+
+	struct SimulatedSpa : Handler
+	{
+		uint32_t address;  //  Network order
+		int listenFd;
+		unsigned int index;
+
+		//  Clock is kept as an offset from the simulator's own clock.
+		long minuteOffset;
+		bool displayAs24Hr;
+		bool timeSet;
+
+		byte currentTemp;
+		byte setTemp;
+		bool celsius;
+		bool highRange;
+		bool lights;
+		byte pump1;
+		byte pump2;
+		bool heating;
+		unsigned long ticks;
+
+		byte filter1[4];
+		byte filter2[4];
+		bool filter2Enabled;
+
+		uint32_t signature;
+	};
+
+
+	struct Connection : Handler
+	{
+		SimulatedSpa *pSpa;
+		int fd;
+		FrameDecoder decoder;
+	};
+
+
+	int epollFd;
+	int discoveryFd;
+	int timerFd;
+	Handler discoveryHandler = {hkDiscovery};
+	Handler timerHandler = {hkTimer};
+
+	std::vector<SimulatedSpa> spas;
+	std::vector<Connection *> connections;
+
+	unsigned long framesSent;
+	unsigned long commandsReceived;
+
+
+	long MinutesNow()
+	{
+		return (long)(time(nullptr) / 60);
+	}
+
+
+	//  A frame to send, zeroed.  Fill in the payload through the fields in
+	//  BalBoaMessages.h, and SendFrame() adds the rest.
+	struct Frame
+	{
+		byte bytes[sizeof(MessageBase) + ConfigResponsePayload::length + sizeof(MessageSuffix)] = {};
+
+		MessageBase &Header()
+		{
+			return *reinterpret_cast<MessageBase *>(bytes);
+		}
+
+		byte *Payload()
+		{
+			return Header().Payload();
+		}
+	};
+
+
+	//  Fill in prefix, length, ID, check byte and suffix around 'length' bytes of payload.
+	void SendFrame(Connection &connection, Frame &frame, uint32_t messageType, byte length)
+	{
+		MessageBase &header = frame.Header();
+
+		header._prefix = 0x7e;
+		header._length = sizeof(MessageBase) + length;
+		WireBytes<3>::Write(header._id, messageType);
+		header.SetCRC();
+		frame.bytes[header._length + 1] = 0x7e;
+
+		const size_t size = header._length + 2;
+
+		//  Like the real thing, a client that isn't keeping up just misses messages.
+		if (send(connection.fd, frame.bytes, size, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)size)
+		{
+			framesSent++;
+		}
+	}
+
+
+	void SendStatus(Connection &connection)
+	{
+		typedef StatusPayload Status;
+
+		const SimulatedSpa &spa = *connection.pSpa;
+		Frame frame;
+		byte *pPayload = frame.Payload();
+
+		const long minutes = (MinutesNow() + spa.minuteOffset) % (24 * 60);
+		const byte hour = (byte)(minutes / 60);
+
+		Status::CurrentTemp::Set(pPayload, spa.currentTemp);
+		Status::Hour::Set(pPayload, hour);
+		Status::Minute::Set(pPayload, (byte)(minutes % 60));
+		Status::TempScaleCelsius::Set(pPayload, spa.celsius);
+		Status::Display24Hr::Set(pPayload, spa.displayAs24Hr);
+		Status::Filter1Running::Set(pPayload, (hour >= spa.filter1[0])
+									&& (hour < spa.filter1[0] + spa.filter1[2]));
+		Status::TempRange::Set(pPayload, spa.highRange);
+		Status::Heating::Set(pPayload, spa.heating ? 1 : 0);
+		Status::Pump1::Set(pPayload, spa.pump1);
+		Status::Pump2::Set(pPayload, spa.pump2);
+		Status::CircPump::Set(pPayload, spa.heating || spa.pump1);
+		Status::Light::Set(pPayload, spa.lights ? 3 : 0);
+		Status::TimeUnset::Set(pPayload, !spa.timeSet);
+		Status::SetTemp::Set(pPayload, spa.setTemp);
+
+		SendFrame(connection, frame, msStatus, Status::length);
+	}
+
+
+	void SendConfig(Connection &connection)
+	{
+		Frame frame;
+
+		//  Values from a real spa with 2 pumps and lights.
+		const byte config[ConfigResponsePayload::length] =
+		{
+			0x02, 0x02, 0x80, 0x00, 0x15, 0x27, 0x10, 0xab, 0xd2, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x15, 0x27, 0xff,
+			0xfe, 0x10, 0xab, 0xd2, 0x00
+		};
+
+		memcpy(frame.Payload(), config, sizeof(config));
+
+		SendFrame(connection, frame, msConfigResponse, ConfigResponsePayload::length);
+	}
+
+
+	void SendFilterConfig(Connection &connection)
+	{
+		typedef FilterConfigPayload Filter;
+
+		const SimulatedSpa &spa = *connection.pSpa;
+		Frame frame;
+		byte *pPayload = frame.Payload();
+
+		Filter::Filter1StartHour::Set(pPayload, spa.filter1[0]);
+		Filter::Filter1StartMinute::Set(pPayload, spa.filter1[1]);
+		Filter::Filter1DurationHours::Set(pPayload, spa.filter1[2]);
+		Filter::Filter1DurationMinutes::Set(pPayload, spa.filter1[3]);
+		Filter::Filter2StartHour::Set(pPayload, spa.filter2[0]);
+		Filter::Filter2Enabled::Set(pPayload, spa.filter2Enabled);
+		Filter::Filter2StartMinute::Set(pPayload, spa.filter2[1]);
+		Filter::Filter2DurationHours::Set(pPayload, spa.filter2[2]);
+		Filter::Filter2DurationMinutes::Set(pPayload, spa.filter2[3]);
+
+		SendFrame(connection, frame, msFilterConfig, Filter::length);
+	}
+
+
+	void SendVersion(Connection &connection)
+	{
+		typedef ControlConfigPayload Version;
+
+		const SimulatedSpa &spa = *connection.pSpa;
+		Frame frame;
+		byte *pPayload = frame.Payload();
+
+		const byte version[Version::Version::length] = {100, 1, 9};
+
+		Version::Version::Set(pPayload, version);
+		Version::Name::Set(pPayload, reinterpret_cast<const byte *>("SIMULATE"));
+		Version::CurrentSetup::Set(pPayload, 1);
+		Version::Signature::Set(pPayload, spa.signature);
+
+		SendFrame(connection, frame, msControlConfig, Version::length);
+	}
+
+
+	void UpdateHeating(SimulatedSpa &spa)
+	{
+		spa.heating = spa.currentTemp < spa.setTemp;
+	}
+
+
+	void HandleCommand(Connection &connection, const MessageBase *pMessage)
+	{
+		SimulatedSpa &spa = *connection.pSpa;
+
+		commandsReceived++;
+
+		const byte *pPayload = pMessage->Payload();
+
+		switch (pMessage->Id())
+		{
+		case msConfigRequest:
+			SendConfig(connection);
+			break;
+
+		case msFilterConfigRequest:  //  Same ID as msControlConfigRequest
+		{
+			const byte kind = SettingsRequestPayload::Kind::Get(pPayload);
+
+			if (kind == 0x01)
+			{
+				SendFilterConfig(connection);
+			}
+			else if (kind == 0x02)
+			{
+				SendVersion(connection);
+			}
+			break;
+		}
+
+		case msToggleItemRequest:
+			switch (ToggleItemPayload::Item::Get(pPayload))
+			{
+			case tiLights:
+				spa.lights = !spa.lights;
+				break;
+
+			case tiPump1:
+				spa.pump1 = (spa.pump1 + 1) % 3;
+				break;
+
+			case tiPump2:
+				spa.pump2 = (spa.pump2 + 1) % 3;
+				break;
+
+			case tiTempRange:
+				spa.highRange = !spa.highRange;
+				break;
+			}
+			break;
+
+		case msSetTempRequest:
+			spa.setTemp = SetTempPayload::Temp::Get(pPayload);
+			UpdateHeating(spa);
+			break;
+
+		case msSetTempScaleRequest:
+		{
+			const bool celsius = SetTempScalePayload::Scale::Get(pPayload);
+
+			if (celsius != spa.celsius)
+			{
+				//  Celsius temperatures are reported doubled.
+				auto convert = [celsius](byte temp) -> byte
+				{
+					return celsius ? (byte)(((temp - 32) * 10 + 4) / 9) : (byte)((temp * 9 + 5) / 10 + 32);
+				};
+
+				spa.currentTemp = convert(spa.currentTemp);
+				spa.setTemp = convert(spa.setTemp);
+				spa.celsius = celsius;
+			}
+			break;
+		}
+
+		case msSetTimeRequest:
+		{
+			typedef SetTimePayload Time;
+
+			spa.minuteOffset = (long)Time::Hour::Get(pPayload) * 60 + Time::Minute::Get(pPayload)
+				- MinutesNow();
+			spa.minuteOffset = ((spa.minuteOffset % (24 * 60)) + 24 * 60) % (24 * 60);
+			spa.displayAs24Hr = Time::DisplayAs24Hr::Get(pPayload);
+			spa.timeSet = true;
+			break;
+		}
+
+		default:
+			if (options.verbose)
+			{
+				fprintf(stderr, "Spa %u: unknown message %06X\n", spa.index,
+						(unsigned int)pMessage->Id());
+			}
+			break;
+		}
+	}
+
+
+	void CloseConnection(Connection *pConnection)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, pConnection->fd, nullptr);
+		close(pConnection->fd);
+
+		for (auto &pEntry : connections)
+		{
+			if (pEntry == pConnection)
+			{
+				pEntry = connections.back();
+				connections.pop_back();
+				break;
+			}
+		}
+
+		delete pConnection;
+	}
+
+
+	void ReadConnection(Connection *pConnection)
+	{
+		for (;;)
+		{
+			size_t space;
+			byte *pBuffer = pConnection->decoder.ReceiveBuffer(space);
+
+			ssize_t amountRead = recv(pConnection->fd, pBuffer, space, MSG_DONTWAIT);
+
+			if (amountRead > 0)
+			{
+				pConnection->decoder.Received((size_t)amountRead);
+
+				while (const MessageBase *pMessage = pConnection->decoder.NextFrame())
+				{
+					HandleCommand(*pConnection, pMessage);
+				}
+				continue;
+			}
+
+			if ((amountRead < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			{
+				return;
+			}
+
+			CloseConnection(pConnection);
+			return;
+		}
+	}
+
+
+	void AcceptConnections(SimulatedSpa &spa)
+	{
+		for (;;)
+		{
+			int fd = accept4(spa.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+			if (fd < 0)
+			{
+				return;
+			}
+
+			const int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+			Connection *pConnection = new Connection;
+
+			pConnection->kind = hkConnection;
+			pConnection->pSpa = &spa;
+			pConnection->fd = fd;
+
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.ptr = pConnection;
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+			connections.push_back(pConnection);
+
+			if (options.verbose)
+			{
+				fprintf(stderr, "Spa %u: connection\n", spa.index);
+			}
+
+			//  Real spas start talking straight away.
+			SendStatus(*pConnection);
+		}
+	}
+
+
+	//  Reply to a discovery broadcast once per spa, from that spa's address.
+	void AnswerDiscovery()
+	{
+		byte request[64];
+		sockaddr_in from;
+		socklen_t fromSize = sizeof(from);
+
+		while (recvfrom(discoveryFd, request, sizeof(request), MSG_DONTWAIT,
+						reinterpret_cast<sockaddr *>(&from), &fromSize) > 0)
+		{
+			if (request[0] != 'D')
+			{
+				continue;
+			}
+
+			for (const SimulatedSpa &spa : spas)
+			{
+				char reply[64];
+				int length = snprintf(reply, sizeof(reply), "BWGSPA\r\n00-15-27-%02X-%02X-%02X\r\n",
+									  (spa.index >> 16) & 0xff, (spa.index >> 8) & 0xff,
+									  spa.index & 0xff);
+
+				iovec data = {reply, (size_t)length};
+				char control[CMSG_SPACE(sizeof(in_pktinfo))] = {};
+				msghdr message = {};
+
+				message.msg_name = &from;
+				message.msg_namelen = fromSize;
+				message.msg_iov = &data;
+				message.msg_iovlen = 1;
+				message.msg_control = control;
+				message.msg_controllen = sizeof(control);
+
+				cmsghdr *pHeader = CMSG_FIRSTHDR(&message);
+				pHeader->cmsg_level = IPPROTO_IP;
+				pHeader->cmsg_type = IP_PKTINFO;
+				pHeader->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+
+				in_pktinfo *pInfo = reinterpret_cast<in_pktinfo *>(CMSG_DATA(pHeader));
+				pInfo->ipi_spec_dst.s_addr = spa.address;
+
+				sendmsg(discoveryFd, &message, 0);
+			}
+
+			fromSize = sizeof(from);
+		}
+	}
+
+
+	void Tick()
+	{
+		uint64_t expirations;
+
+		if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		{
+			return;
+		}
+
+		for (SimulatedSpa &spa : spas)
+		{
+			//  One degree a minute, toward the set point.
+			if ((++spa.ticks % (60000 / options.cadence + 1)) == 0)
+			{
+				if (spa.currentTemp < spa.setTemp)
+				{
+					spa.currentTemp++;
+				}
+				else if (!spa.heating && (spa.currentTemp > spa.setTemp))
+				{
+					spa.currentTemp--;
+				}
+				UpdateHeating(spa);
+			}
+		}
+
+		for (Connection *pConnection : connections)
+		{
+			SendStatus(*pConnection);
+		}
+	}
+
+
+	int OpenSocket(int type, uint32_t address, uint16_t port)
+	{
+		int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (fd < 0)
+		{
+			return -1;
+		}
+
+		const int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		sockaddr_in bindTo = {};
+		bindTo.sin_family = AF_INET;
+		bindTo.sin_addr.s_addr = address;
+		bindTo.sin_port = htons(port);
+
+		if (bind(fd, reinterpret_cast<sockaddr *>(&bindTo), sizeof(bindTo)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+
+	void Watch(int fd, Handler *pHandler)
+	{
+		epoll_event event = {};
+
+		event.events = EPOLLIN;
+		event.data.ptr = pHandler;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+	}
+
+
+	bool ParseOptions(int argc, char *argv[])
+	{
+		int option;
+
+		while ((option = getopt(argc, argv, "n:c:a:p:d:v")) != -1)
+		{
+			switch (option)
+			{
+			case 'n':
+				options.spaCount = strtoul(optarg, nullptr, 0);
+				break;
+
+			case 'c':
+				options.cadence = strtoul(optarg, nullptr, 0);
+				break;
+
+			case 'a':
+			{
+				in_addr address;
+
+				if (inet_pton(AF_INET, optarg, &address) != 1)
+				{
+					return false;
+				}
+				options.firstAddress = ntohl(address.s_addr);
+				break;
+			}
+
+			case 'p':
+				options.comPort = (uint16_t)strtoul(optarg, nullptr, 0);
+				break;
+
+			case 'd':
+				options.discoveryPort = (uint16_t)strtoul(optarg, nullptr, 0);
+				break;
+
+			case 'v':
+				options.verbose = true;
+				break;
+
+			default:
+				return false;
+			}
+		}
+
+		return (options.spaCount > 0) && (options.cadence > 0);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (!ParseOptions(argc, argv))
+	{
+		fprintf(stderr, "Usage: %s [-n spas] [-c cadence-ms] [-a first-address] [-p tcp-port] "
+				"[-d discovery-port] [-v]\n", argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	//  Two descriptors per spa with a client, plus one to listen.
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	discoveryFd = OpenSocket(SOCK_DGRAM, htonl(INADDR_ANY), options.discoveryPort);
+	if (discoveryFd < 0)
+	{
+		perror("Discovery socket");
+		return 1;
+	}
+
+	const int one = 1;
+	setsockopt(discoveryFd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+	Watch(discoveryFd, &discoveryHandler);
+
+	spas.resize(options.spaCount);
+
+	for (unsigned int i = 0; i < options.spaCount; i++)
+	{
+		SimulatedSpa &spa = spas[i];
+
+		//  Skip .0 and .255 in the last octet, they look like network / broadcast.
+		uint32_t address = options.firstAddress;
+		for (unsigned int skip = 0; skip < i; skip++)
+		{
+			do
+			{
+				address++;
+			} while (((address & 0xff) == 0) || ((address & 0xff) == 0xff));
+		}
+
+		spa.kind = hkListener;
+		spa.index = i;
+		spa.address = htonl(address);
+		spa.minuteOffset = (12 * 60 - MinutesNow() % (24 * 60) + 24 * 60) % (24 * 60);
+		spa.displayAs24Hr = false;
+		spa.timeSet = true;
+		spa.currentTemp = 98 + (byte)(i % 5);
+		spa.setTemp = 102;
+		spa.celsius = false;
+		spa.highRange = true;
+		spa.lights = false;
+		spa.pump1 = 0;
+		spa.pump2 = 0;
+		spa.ticks = i;
+		spa.filter1[0] = 8, spa.filter1[1] = 0, spa.filter1[2] = 2, spa.filter1[3] = 0;
+		spa.filter2[0] = 20, spa.filter2[1] = 0, spa.filter2[2] = 1, spa.filter2[3] = 0;
+		spa.filter2Enabled = true;
+		spa.signature = 0x5a5a0000 | i;
+		UpdateHeating(spa);
+
+		spa.listenFd = OpenSocket(SOCK_STREAM, spa.address, options.comPort);
+
+		if ((spa.listenFd < 0) || (listen(spa.listenFd, 16) != 0))
+		{
+			fprintf(stderr, "Spa %u: can't listen on %s:%u - %s\n", i,
+					inet_ntoa(in_addr{spa.address}), options.comPort, strerror(errno));
+			return 1;
+		}
+	}
+
+	//  Watch the listeners only once the vector has stopped moving.
+	for (SimulatedSpa &spa : spas)
+	{
+		Watch(spa.listenFd, &spa);
+	}
+
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	itimerspec period = {};
+	period.it_interval.tv_sec = options.cadence / 1000;
+	period.it_interval.tv_nsec = (options.cadence % 1000) * 1000000;
+	period.it_value = period.it_interval;
+	timerfd_settime(timerFd, 0, &period, nullptr);
+	Watch(timerFd, &timerHandler);
+
+	fprintf(stderr, "Simulating %u spa(s) from %s, status every %lu ms\n", options.spaCount,
+			inet_ntoa(in_addr{spas[0].address}), options.cadence);
+
+	unsigned long lastReport = millis();
+
+	for (;;)
+	{
+		epoll_event events[256];
+
+		int count = epoll_wait(epollFd, events, 256, 1000);
+
+		for (int i = 0; i < count; i++)
+		{
+			Handler *pHandler = static_cast<Handler *>(events[i].data.ptr);
+
+			switch (pHandler->kind)
+			{
+			case hkDiscovery:
+				AnswerDiscovery();
+				break;
+
+			case hkTimer:
+				Tick();
+				break;
+
+			case hkListener:
+				AcceptConnections(*static_cast<SimulatedSpa *>(pHandler));
+				break;
+
+			case hkConnection:
+				ReadConnection(static_cast<Connection *>(pHandler));
+				break;
+			}
+		}
+
+		if (options.verbose && ((millis() - lastReport) >= 10000))
+		{
+			lastReport = millis();
+			fprintf(stderr, "%zu connections, %lu frames sent, %lu commands received\n",
+					connections.size(), framesSent, commandsReceived);
+		}
+	}
+}
@@ -0,0 +1,190 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaAnalyzer.h"
+
+#if BALBOA_ANALYZER
+
+namespace
+{
+	//  Bits *not* decoded by BalBoaSpa, per payload byte.  Keep in step with
+	//  CrackStatusMessage():  a field named in BALBOA_STATUS_FIELDS (BalBoaMessages.h)
+	//  that nothing decodes yet, like the heating mode and hold, is still watched.
+	const byte statusUnknownBits[BalBoa::ProtocolAnalyzer::statusBytes] PROGMEM =
+	{
+		0xff,  // 00 _r1
+		0xfe,  // 01 _priming
+		0x00,  // 02 _currentTemp
+		0x00,  // 03 _hour
+		0x00,  // 04 _minute
+		0xff,  // 05 _heatingMode, not decoded
+		0xf1,  // 06 _panelMessage, bit 0 is pmUnknown
+		0xff,  // 07 _r2
+		0xff,  // 08 _holdTime, not decoded
+		0xf0,  // 09 _tempScaleCelsius, _24hrTime, _filter1Running, _filter2Running
+		0xcb,  // 10 _r3, _tempRange, _r4, _heating
+		0xf0,  // 11 _pump1, _pump2
+		0xff,  // 12 _r5
+		0xfd,  // 13 _r6, _circPump
+		0xfc,  // 14 _light
+		0xff,  // 15 _r7
+		0xff,  // 16 _r7
+		0xff,  // 17 _r7
+		0xfd,  // 18 _r7a, _timeUnset
+		0xff,  // 19 _r7b
+		0x00,  // 20 _setTemp
+		0xff,  // 21 _r8, _systemHold (not decoded)
+		0xff,  // 22 _r9
+		0xff   // 23 _r9
+	};
+
+	//  Nothing in the configuration response is understood yet.
+	const byte configUnknownBits[BalBoa::ProtocolAnalyzer::configBytes] PROGMEM =
+	{
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff
+	};
+
+	static_assert(BalBoa::StatusPayload::length == BalBoa::ProtocolAnalyzer::statusBytes,
+				  "Status payload length changed");
+
+	static_assert(BalBoa::ConfigResponsePayload::length == BalBoa::ProtocolAnalyzer::configBytes,
+				  "Configuration response length changed");
+}
+
+
+BalBoa::ProtocolAnalyzer::ProtocolAnalyzer()
+{
+	Reset();
+}
+
+
+void
+BalBoa::ProtocolAnalyzer::Reset()
+{
+	_haveStatus = false;
+	_haveConfig = false;
+	memset(_statusChanges, 0, sizeof(_statusChanges));
+	memset(_configChanges, 0, sizeof(_configChanges));
+	_nextTransition = 0;
+}
+
+
+void
+BalBoa::ProtocolAnalyzer::Record(
+	Source source,
+	const byte *pPayload,
+	unsigned long now)
+{
+	if (source == srcStatus)
+	{
+		Record(srcStatus, pPayload, statusUnknownBits, statusBytes, _previousStatus,
+			   _statusChanges, _haveStatus, now);
+	}
+	else
+	{
+		Record(srcConfig, pPayload, configUnknownBits, configBytes, _previousConfig,
+			   _configChanges, _haveConfig, now);
+	}
+}
+
+
+void
+BalBoa::ProtocolAnalyzer::Record(
+	Source source,
+	const byte *pPayload,
+	const byte *pMask,
+	byte count,
+	byte *pPrevious,
+	uint16_t *pCounts,
+	bool &havePrevious,
+	unsigned long now)
+{
+	for (byte i = 0; i < count; i++)
+	{
+		const byte current = pPayload[i] & pgm_read_byte(pMask + i);
+
+		if (havePrevious && (current != pPrevious[i]))
+		{
+			pCounts[i]++;
+
+			Transition &transition = _transitions[_nextTransition++ & (BALBOA_ANALYZER_SIZE - 1)];
+
+			transition.time = now;
+			transition.source = source;
+			transition.offset = i;
+			transition.before = pPrevious[i];
+			transition.after = current;
+		}
+
+		pPrevious[i] = current;
+	}
+
+	havePrevious = true;
+}
+
+
+uint16_t
+BalBoa::ProtocolAnalyzer::ChangeCount(
+	Source source,
+	byte offset) const
+{
+	if (source == srcStatus)
+	{
+		return (offset < statusBytes) ? _statusChanges[offset] : 0;
+	}
+
+	return (offset < configBytes) ? _configChanges[offset] : 0;
+}
+
+
+unsigned int
+BalBoa::ProtocolAnalyzer::TransitionCount() const
+{
+	return min(_nextTransition, (unsigned int)BALBOA_ANALYZER_SIZE);
+}
+
+
+const BalBoa::ProtocolAnalyzer::Transition &
+BalBoa::ProtocolAnalyzer::GetTransition(
+	unsigned int index) const
+{
+	const unsigned int first = _nextTransition - TransitionCount();
+
+	return _transitions[(first + index) & (BALBOA_ANALYZER_SIZE - 1)];
+}
+
+
+void
+BalBoa::ProtocolAnalyzer::Dump(Print &output) const
+{
+	output.println(F("Status byte change counts:"));
+	for (byte i = 0; i < statusBytes; i++)
+	{
+		output.print(_statusChanges[i]), output.print(' ');
+	}
+	output.println();
+
+	output.println(F("Config byte change counts:"));
+	for (byte i = 0; i < configBytes; i++)
+	{
+		output.print(_configChanges[i]), output.print(' ');
+	}
+	output.println();
+
+	output.println(F("Transitions (ms, S/C, byte, before, after):"));
+	for (unsigned int i = 0; i < TransitionCount(); i++)
+	{
+		const Transition &transition = GetTransition(i);
+
+		output.print(transition.time), output.print(' ');
+		output.print(transition.source == srcStatus ? 'S' : 'C'), output.print(' ');
+		output.print((int)transition.offset), output.print(' ');
+		output.print((int)transition.before, HEX), output.print(' ');
+		output.println((int)transition.after, HEX);
+	}
+}
+
+#endif
@@ -0,0 +1,86 @@
+//  Protocol discovery aid.  Watches the parts of the status and configuration messages
+//  that aren't understood yet (the '_r*' fields and unnamed bits), counts how often each
+//  byte changes, and keeps a time stamped list of the most recent changes.  Correlate
+//  those with what you did at the panel to work out what the bits mean.
+//
+//  Compiled in only when BALBOA_ANALYZER is defined non-zero; otherwise it costs nothing.
+//  BALBOA_ANALYZER_SIZE sets how many transitions are kept (power of 2).
+
+#ifndef _BALBOAANALYZER_h
+#define _BALBOAANALYZER_h
+
+#ifndef BALBOA_ANALYZER
+#define BALBOA_ANALYZER 0
+#endif
+
+#ifndef BALBOA_ANALYZER_SIZE
+#define BALBOA_ANALYZER_SIZE 32
+#endif
+
+#if BALBOA_ANALYZER
+
+class Print;
+
+namespace BalBoa
+{
+	class ProtocolAnalyzer
+	{
+	public:
+		static_assert((BALBOA_ANALYZER_SIZE & (BALBOA_ANALYZER_SIZE - 1)) == 0,
+					  "BALBOA_ANALYZER_SIZE must be a power of 2");
+
+		enum Source : byte
+		{
+			srcStatus,
+			srcConfig
+		};
+
+		static constexpr byte statusBytes = 24;
+		static constexpr byte configBytes = 25;
+
+		struct Transition
+		{
+			unsigned long time;  //  millis()
+			Source source;
+			byte offset;         //  Payload byte number, as in BalBoaMessages.h
+			byte before;         //  Unknown bits only, known bits are always 0
+			byte after;
+		};
+
+		ProtocolAnalyzer();
+
+		//  Forget everything seen so far.
+		void Reset();
+
+		//  A status or configuration response payload, only read.
+		void Record(Source, const byte *pPayload, unsigned long now);
+
+		//  How many times the unknown bits of a payload byte have changed.
+		uint16_t ChangeCount(Source, byte offset) const;
+
+		//  Transitions, oldest first.  Older ones are dropped once the buffer is full.
+		unsigned int TransitionCount() const;
+		const Transition &GetTransition(unsigned int) const;
+
+		//  Human readable summary of the above.
+		void Dump(Print &) const;
+
+	private:
+		void Record(Source, const byte *pPayload, const byte *pMask, byte count,
+					byte *pPrevious, uint16_t *pCounts, bool &havePrevious,
+					unsigned long now);
+
+		byte _previousStatus[statusBytes];
+		byte _previousConfig[configBytes];
+		bool _haveStatus;
+		bool _haveConfig;
+		uint16_t _statusChanges[statusBytes];
+		uint16_t _configChanges[configBytes];
+
+		Transition _transitions[BALBOA_ANALYZER_SIZE];
+		unsigned int _nextTransition;
+	};
+}
+
+#endif
+#endif
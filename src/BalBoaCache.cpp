@@ -0,0 +1,206 @@
+
+#include "BalBoaPlatform.h"
+#include "crc.h"
+#include "BalBoaSpa.h"
+#include "BalBoaCache.h"
+#include "BalBoaLog.h"
+
+#if BALBOA_CACHE
+
+#if defined ARDUINO_ARCH_ESP32
+#include <Preferences.h>
+#elif defined ARDUINO
+#include <EEPROM.h>
+#else
+#include <stdio.h>
+#endif
+
+namespace
+{
+	//  What actually gets stored.  Magic and size catch a blank or foreign store, and a
+	//  changed layout after a library update; the check byte catches the rest.
+	struct StoredRecord
+	{
+		uint16_t magic;
+		byte size;
+		BalBoa::SpaCacheRecord record;
+		byte check;
+	};
+
+	static_assert(sizeof(StoredRecord) <= 0xff, "Cache record too big for its size byte");
+
+	constexpr uint16_t cacheMagic = 0xBA5A;
+
+	byte CheckByte(const BalBoa::SpaCacheRecord &record)
+	{
+		return F_CRC_CalculaCheckSum(reinterpret_cast<const uint8_t *>(&record), sizeof(record));
+	}
+
+	bool ReadStore(StoredRecord &);
+	void WriteStore(const StoredRecord &);
+
+#if defined ARDUINO_ARCH_ESP32
+	const char cacheNamespace[] = "balboa";
+	const char cacheKey[] = "spa";
+
+	bool ReadStore(StoredRecord &stored)
+	{
+		Preferences preferences;
+
+		if (!preferences.begin(cacheNamespace, true))
+		{
+			return false;
+		}
+
+		size_t size = preferences.getBytes(cacheKey, &stored, sizeof(stored));
+
+		preferences.end();
+
+		return size == sizeof(stored);
+	}
+
+	void WriteStore(const StoredRecord &stored)
+	{
+		Preferences preferences;
+
+		if (preferences.begin(cacheNamespace, false))
+		{
+			preferences.putBytes(cacheKey, &stored, sizeof(stored));
+			preferences.end();
+		}
+	}
+
+#elif defined ARDUINO_ARCH_ESP8266
+	//  EEPROM is emulated in flash, and has to be sized before use.
+	bool ReadStore(StoredRecord &stored)
+	{
+		EEPROM.begin(BALBOA_CACHE_ADDRESS + sizeof(StoredRecord));
+		EEPROM.get(BALBOA_CACHE_ADDRESS, stored);
+
+		return true;
+	}
+
+	void WriteStore(const StoredRecord &stored)
+	{
+		EEPROM.begin(BALBOA_CACHE_ADDRESS + sizeof(StoredRecord));
+		EEPROM.put(BALBOA_CACHE_ADDRESS, stored);
+		EEPROM.commit();
+	}
+
+#elif defined ARDUINO
+	bool ReadStore(StoredRecord &stored)
+	{
+		EEPROM.get(BALBOA_CACHE_ADDRESS, stored);
+
+		return true;
+	}
+
+	//  EEPROM.put() only writes the bytes that differ.
+	void WriteStore(const StoredRecord &stored)
+	{
+		EEPROM.put(BALBOA_CACHE_ADDRESS, stored);
+	}
+
+#else
+	bool ReadStore(StoredRecord &stored)
+	{
+		if (BalBoa::CacheFile == nullptr)
+		{
+			return false;
+		}
+
+		FILE *pFile = fopen(BalBoa::CacheFile, "rb");
+
+		if (pFile == nullptr)
+		{
+			return false;
+		}
+
+		size_t count = fread(&stored, sizeof(stored), 1, pFile);
+
+		fclose(pFile);
+
+		return count == 1;
+	}
+
+	//  Written to a temporary file and renamed, so a crash never leaves half a record.
+	void WriteStore(const StoredRecord &stored)
+	{
+		if (BalBoa::CacheFile == nullptr)
+		{
+			return;
+		}
+
+		char tempName[256];
+
+		snprintf(tempName, sizeof(tempName), "%s.new", BalBoa::CacheFile);
+
+		FILE *pFile = fopen(tempName, "wb");
+
+		if (pFile == nullptr)
+		{
+			BALBOA_LOG_WARN(F("Can't write spa cache"));
+			return;
+		}
+
+		size_t count = fwrite(&stored, sizeof(stored), 1, pFile);
+
+		if ((fclose(pFile) == 0) && (count == 1))
+		{
+			rename(tempName, BalBoa::CacheFile);
+		}
+		else
+		{
+			remove(tempName);
+		}
+	}
+#endif
+}
+
+
+#if !defined ARDUINO
+const char *BalBoa::CacheFile = nullptr;
+#endif
+
+
+bool
+BalBoa::LoadSpaCache(SpaCacheRecord &record)
+{
+	StoredRecord stored;
+
+	if (!ReadStore(stored))
+	{
+		return false;
+	}
+
+	if ((stored.magic != cacheMagic) || (stored.size != sizeof(stored))
+		|| (stored.check != CheckByte(stored.record)))
+	{
+		BALBOA_LOG_INFO(F("No valid spa cache"));
+		return false;
+	}
+
+	memcpy(&record, &stored.record, sizeof(record));
+
+	return true;
+}
+
+
+void
+BalBoa::SaveSpaCache(const SpaCacheRecord &record)
+{
+	StoredRecord stored;
+
+	memset(&stored, 0, sizeof(stored));
+
+	stored.magic = cacheMagic;
+	stored.size = sizeof(stored);
+	memcpy(&stored.record, &record, sizeof(record));
+	stored.check = CheckByte(stored.record);
+
+	BALBOA_LOG_DEBUG(F("Saving spa cache"));
+
+	WriteStore(stored);
+}
+
+#endif
@@ -0,0 +1,51 @@
+//  Remembers the spa between restarts:  its address, version info (with the config
+//  signature) and filter times.  With a valid cache, BalBoaSpa connects straight to the
+//  cached address and reports the cached info at once, only asking the spa for it again
+//  if the signature it reports doesn't match.
+//
+//  Storage is per platform:  Preferences (NVS) on ESP32, EEPROM on AVR and ESP8266, and
+//  a file on Linux.  The EEPROM is usually shared with the sketch, so there it's off
+//  unless BALBOA_CACHE is defined to 1, and stored at BALBOA_CACHE_ADDRESS.  On Linux
+//  set BalBoa::CacheFile to turn it on.
+
+#ifndef _BALBOACACHE_h
+#define _BALBOACACHE_h
+
+#if !defined BALBOA_CACHE
+#if defined ARDUINO_ARCH_ESP32 || !defined ARDUINO
+#define BALBOA_CACHE 1
+#else
+#define BALBOA_CACHE 0
+#endif
+#endif
+
+#if !defined BALBOA_CACHE_ADDRESS
+#define BALBOA_CACHE_ADDRESS 0
+#endif
+
+#if BALBOA_CACHE
+
+namespace BalBoa
+{
+	//  Compared byte for byte to avoid needless writes, so always clear it before
+	//  filling it in.
+	struct SpaCacheRecord
+	{
+		byte _address[4];
+		VersionInfo _version;
+		FilterInfo _filters;
+	};
+
+	//  False if there's nothing stored, or it doesn't check out.
+	bool LoadSpaCache(SpaCacheRecord &);
+	void SaveSpaCache(const SpaCacheRecord &);
+
+#if !defined ARDUINO
+	//  Where the cache is kept, nullptr (the default) for no cache.
+	extern const char *CacheFile;
+#endif
+}
+
+#endif
+
+#endif
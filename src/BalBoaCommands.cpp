@@ -0,0 +1,255 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaCommands.h"
+#include "BalBoaLog.h"
+
+#if BALBOA_COMMAND_TRACKING
+
+const uint16_t BalBoa::CommandTracker::latencyLimits[latencyBuckets - 1] PROGMEM =
+{
+	250, 500, 1000, 2000, 4000, 8000, 16000
+};
+
+
+BalBoa::CommandTracker::CommandTracker()
+	: _pendingCount(0)
+{
+	memset(_commands, 0, sizeof(_commands));
+	memset(_stats, 0, sizeof(_stats));
+}
+
+
+void
+BalBoa::CommandTracker::Sent(
+	BalBoa::CommandType type,
+	const BalBoa::MessageBase *pMessage,
+	uint16_t current,
+	uint16_t expected,
+	bool expectChange,
+	unsigned long now)
+{
+	Command &command = _commands[type];
+
+	if (command.status == csPending)
+	{
+		if (expectChange)
+		{
+			//  Still looking for a change from before the first one.
+			current = command.expected;
+		}
+
+		_pendingCount--;
+	}
+
+	if (expectChange ? (current == unknownValue) : (expected == unknownValue))
+	{
+		//  Nothing to check it against.
+		command.status = csNone;
+		return;
+	}
+
+	command.status = csPending;
+	command.retries = 0;
+	command.expectChange = expectChange;
+	command.stillNeeded = false;
+	command.expected = expectChange ? current : expected;
+	command.firstSent = now;
+	command.lastSent = now;
+	memcpy(command.message, pMessage, min((size_t)(pMessage->_length + 2), sizeof(command.message)));
+
+	_pendingCount++;
+
+	//  e.g. a toggle that undoes one still waiting.
+	if (!expectChange && Matches(type, current, expected))
+	{
+		Finish(type, csConfirmed, now);
+	}
+}
+
+
+void
+BalBoa::CommandTracker::Observe(
+	BalBoa::CommandType type,
+	uint16_t current,
+	unsigned long now)
+{
+	const Command &command = _commands[type];
+
+	if ((command.status != csPending) || (current == unknownValue))
+	{
+		return;
+	}
+
+	if (command.expectChange ? (current != command.expected)
+		: Matches(type, current, command.expected))
+	{
+		Finish(type, csConfirmed, now);
+	}
+}
+
+
+void
+BalBoa::CommandTracker::StatusSeen(unsigned long now)
+{
+	for (Command &command : _commands)
+	{
+		if ((command.status == csPending) && ((now - command.lastSent) >= BALBOA_COMMAND_TIMEOUT / 2))
+		{
+			//  The spa has had plenty of time to apply it, and hasn't.
+			command.stillNeeded = true;
+		}
+	}
+}
+
+
+bool
+BalBoa::CommandTracker::RetryDue(
+	BalBoa::CommandType type,
+	unsigned long now)
+{
+	Command &command = _commands[type];
+
+	if ((command.status != csPending) || ((now - command.lastSent) < BALBOA_COMMAND_TIMEOUT))
+	{
+		return false;
+	}
+
+	if (command.retries >= BALBOA_COMMAND_RETRIES)
+	{
+		BALBOA_LOG_WARN(F("Command not confirmed by spa!"));
+
+		Finish(type, csFailed, now);
+		return false;
+	}
+
+	command.retries++;
+	command.lastSent = now;
+
+	if (IsToggle(type) && !command.stillNeeded)
+	{
+		//  For all we know the status is just late, and it's been done.
+		BALBOA_LOG_INFO(F("No status to check the toggle against, not sending it again"));
+		return false;
+	}
+
+	command.stillNeeded = false;
+	_stats[type].retries++;
+
+	return true;
+}
+
+
+BalBoa::MessageBase *
+BalBoa::CommandTracker::GetMessage(BalBoa::CommandType type)
+{
+	return reinterpret_cast<MessageBase *>(_commands[type].message);
+}
+
+
+uint16_t
+BalBoa::CommandTracker::Target(
+	BalBoa::CommandType type,
+	uint16_t current) const
+{
+	const Command &command = _commands[type];
+
+	return ((command.status == csPending) && !command.expectChange) ? command.expected : current;
+}
+
+
+bool
+BalBoa::CommandTracker::Matches(
+	BalBoa::CommandType type,
+	uint16_t current,
+	uint16_t expected)
+{
+	if (type == ctSetTime)
+	{
+		//  Minutes since midnight; the clock may well tick over before we see it.
+		return ((current + 24 * 60 - expected) % (24 * 60)) <= 1;
+	}
+
+	return current == expected;
+}
+
+
+bool
+BalBoa::CommandTracker::IsToggle(BalBoa::CommandType type)
+{
+	switch (type)
+	{
+	case ctLights:
+	case ctPump1:
+	case ctPump2:
+	case ctTempRange:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+void
+BalBoa::CommandTracker::Finish(
+	BalBoa::CommandType type,
+	BalBoa::CommandStatus status,
+	unsigned long now)
+{
+	Command &command = _commands[type];
+	Stats &stats = _stats[type];
+
+	command.status = status;
+	_pendingCount--;
+
+	if (status == csFailed)
+	{
+		stats.failed++;
+		return;
+	}
+
+	const unsigned long latency = now - command.firstSent;
+	byte bucket = 0;
+
+	while ((bucket < latencyBuckets - 1) && (latency >= pgm_read_word(&latencyLimits[bucket])))
+	{
+		bucket++;
+	}
+
+	if (stats.latency[bucket] < 0xffff)
+	{
+		stats.latency[bucket]++;
+	}
+
+	stats.confirmed++;
+}
+
+
+void
+BalBoa::CommandTracker::Dump(Print &output) const
+{
+	output.print(F("Command latency (ms <"));
+	for (byte i = 0; i < latencyBuckets - 1; i++)
+	{
+		output.print(' '), output.print(pgm_read_word(&latencyLimits[i]));
+	}
+	output.println(F(" more), confirmed, retries, failed:"));
+
+	for (byte type = 0; type < ctCOUNT; type++)
+	{
+		const Stats &stats = _stats[type];
+
+		output.print((int)type), output.print(':');
+		for (byte i = 0; i < latencyBuckets; i++)
+		{
+			output.print(' '), output.print(stats.latency[i]);
+		}
+		output.print(F(", ")), output.print(stats.confirmed);
+		output.print(F(", ")), output.print(stats.retries);
+		output.print(F(", ")), output.println(stats.failed);
+	}
+}
+
+#endif
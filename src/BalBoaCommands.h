@@ -0,0 +1,156 @@
+//  Command acknowledgement tracking.  Each command records what the spa should report
+//  once it's been applied (lights on, set point 102, ...), and later status messages are
+//  checked against that.  Commands not confirmed within BALBOA_COMMAND_TIMEOUT ms are sent
+//  again, up to BALBOA_COMMAND_RETRIES times, then marked failed.  Time from first send to
+//  confirmation goes into a histogram per command type.
+//
+//  Setting the temperature, time or scale can safely be sent twice, a toggle can't:  if
+//  the status is only late, sending it again would flip it back.  So a toggle is only sent
+//  again once a status from at least BALBOA_COMMAND_TIMEOUT / 2 ms after it was sent still
+//  shows it not done.  Without one, the retry is used up but nothing is sent.
+//
+//  There's one slot per type of command; a newer command of the same type takes over the
+//  slot.  Toggles are tracked by the state they should end up in, so a toggle pair
+//  cancelled in the outgoing queue is confirmed straight away.  Pump toggles just expect
+//  the speed to change, since pumps differ in how many speeds they have.
+//
+//  On by default except on AVR, where RAM is short.  Define BALBOA_COMMAND_TRACKING to
+//  override.
+
+#ifndef _BALBOACOMMANDS_h
+#define _BALBOACOMMANDS_h
+
+#if !defined BALBOA_COMMAND_TRACKING
+#if defined ARDUINO_ARCH_AVR
+#define BALBOA_COMMAND_TRACKING 0
+#else
+#define BALBOA_COMMAND_TRACKING 1
+#endif
+#endif
+
+#if !defined BALBOA_COMMAND_TIMEOUT
+#define BALBOA_COMMAND_TIMEOUT 4000
+#endif
+
+#if !defined BALBOA_COMMAND_RETRIES
+#define BALBOA_COMMAND_RETRIES 2
+#endif
+
+//  Scenes (SpaProtocol::SetScene()):  how long to let a batch of commands take effect
+//  before planning again from the latest status, and how many batches before giving up.
+//  Not while the tracker is still waiting on any of the batch, it re-sends those itself.
+#if !defined BALBOA_SCENE_SETTLE
+#define BALBOA_SCENE_SETTLE 3000
+#endif
+
+#if !defined BALBOA_SCENE_ROUNDS
+#define BALBOA_SCENE_ROUNDS 3
+#endif
+
+class Print;
+
+namespace BalBoa
+{
+	enum CommandType : byte
+	{
+		ctLights,
+		ctPump1,
+		ctPump2,
+		ctTempRange,
+		ctSetTemp,
+		ctTempScale,
+		ctSetTime,
+		ctCOUNT
+	};
+
+	enum CommandStatus : byte
+	{
+		csNone,       //  No command of this type sent (or it couldn't be tracked)
+		csPending,    //  Sent, not yet seen in a status message
+		csConfirmed,  //  Status message shows it was applied
+		csFailed      //  Not seen after all retries
+	};
+
+#if BALBOA_COMMAND_TRACKING
+	class CommandTracker
+	{
+	public:
+		//  Upper bounds (ms) of the latency buckets, the last bucket is everything above.
+		static constexpr byte latencyBuckets = 8;
+		static const uint16_t latencyLimits[latencyBuckets - 1];
+
+		//  Used where a value (e.g. lights) isn't known yet.
+		static constexpr uint16_t unknownValue = 0xffff;
+
+		struct Stats
+		{
+			uint16_t latency[latencyBuckets];
+			uint16_t confirmed;
+			uint16_t retries;
+			uint16_t failed;
+		};
+
+		CommandTracker();
+
+		//  A command's been sent.  It's confirmed once the spa reports 'expected', or with
+		//  'expectChange', anything other than 'current'.
+		void Sent(CommandType, const MessageBase *, uint16_t current, uint16_t expected,
+				  bool expectChange, unsigned long now);
+
+		//  What the spa reports now.
+		void Observe(CommandType, uint16_t current, unsigned long now);
+
+		//  A status message has arrived, and been Observe()d.
+		void StatusSeen(unsigned long now);
+
+		//  True if the command is due to be sent again (GetMessage() has it).  Marks it
+		//  failed when out of retries.  Toggles only once the status shows they're needed.
+		bool RetryDue(CommandType, unsigned long now);
+		MessageBase *GetMessage(CommandType);
+
+		//  What a pending toggle will leave things at, or 'current' if none is pending.
+		uint16_t Target(CommandType, uint16_t current) const;
+
+		bool Pending() const
+		{
+			return _pendingCount > 0;
+		};
+
+		CommandStatus GetStatus(CommandType type) const
+		{
+			return static_cast<CommandStatus>(_commands[type].status);
+		};
+
+		const Stats &GetStats(CommandType type) const
+		{
+			return _stats[type];
+		};
+
+		//  Human readable summary of the above.
+		void Dump(Print &) const;
+
+	private:
+		static bool Matches(CommandType, uint16_t current, uint16_t expected);
+		static bool IsToggle(CommandType);
+		void Finish(CommandType, CommandStatus, unsigned long now);
+
+		struct Command
+		{
+			byte status;
+			byte retries;
+			bool expectChange;
+			bool stillNeeded;   //  A status well after lastSent doesn't show it
+			uint16_t expected;
+			unsigned long firstSent;
+			unsigned long lastSent;   //  Or when a toggle's retry was used up unsent
+			byte message[CommandQueue::maxMessageLength];
+		};
+
+		Command _commands[ctCOUNT];
+		Stats _stats[ctCOUNT];
+		byte _pendingCount;
+	};
+#endif
+}
+
+#endif
@@ -0,0 +1,196 @@
+
+#include "BalBoaPlatform.h"
+#include "crc.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaLog.h"
+
+namespace
+{
+	constexpr byte framePrefix = 0x7e;
+	constexpr byte frameSuffix = 0x7e;
+
+	//  Prefix, length, 3 byte ID, check byte and suffix.
+	constexpr byte minFrameLength = 7;
+}
+
+
+BalBoa::FrameDecoder::FrameDecoder()
+{
+	Reset();
+}
+
+
+void
+BalBoa::FrameDecoder::Reset()
+{
+	_head = _scan = _tail = 0;
+	_state = dsPrefix;
+	_used = 0;
+}
+
+
+bool
+BalBoa::FrameDecoder::Idle() const
+{
+	return _head == _tail;
+}
+
+
+byte *
+BalBoa::FrameDecoder::ReceiveBuffer(size_t &space)
+{
+	const byte used = (_tail - _head) & _ringMask;
+
+	space = ringSize - 1 - used;
+
+	//  Only up to the end of the array, the caller comes back for the rest.
+	space = min(space, (size_t)(ringSize - _tail));
+
+	return _ring + _tail;
+}
+
+
+void
+BalBoa::FrameDecoder::Received(size_t count)
+{
+	_tail = (_tail + count) & _ringMask;
+}
+
+
+const BalBoa::MessageBase *
+BalBoa::FrameDecoder::NextFrame()
+{
+	while (_scan != _tail)
+	{
+		const byte position = _scan;
+
+		_scan = (_scan + 1) & _ringMask;
+
+		const StepResult result = Step(_ring[position]);
+
+		switch (result)
+		{
+		case srMore:
+			if (_state == dsPrefix)
+			{
+				//  Not in a frame, nothing worth keeping.
+				_head = _scan;
+			}
+			else if (_used == 1)
+			{
+				//  Frame (re)starts at this prefix.
+				_head = position;
+			}
+			break;
+
+		case srFrame:
+			_head = _scan;
+			_frames++;
+			return reinterpret_cast<const MessageBase *>(_frame);
+
+		case srBadFrame:
+		case srBadCRC:
+			Resync(result);
+			break;
+		}
+	}
+
+	return nullptr;
+}
+
+
+void
+BalBoa::FrameDecoder::Resync(StepResult result)
+{
+	if (result == srBadCRC)
+	{
+		_crcErrors++;
+		BALBOA_TRACE(teCRCError, _frame[1]);
+		BALBOA_LOG_WARN(F("CRC mismatch?"));
+	}
+	else
+	{
+		_framingErrors++;
+		BALBOA_TRACE(teFramingError, _used);
+		BALBOA_LOG_WARN(F("Bad frame!"));
+	}
+
+	BALBOA_LOG_DUMP(BALBOA_LEVEL_DEBUG, _frame, _used);
+
+	//  Skip only the prefix that started the bad frame.  Anything after it is looked at
+	//  again, in case the real start of the next frame was swallowed.
+	_head = (_head + 1) & _ringMask;
+	_scan = _head;
+	_state = dsPrefix;
+	_used = 0;
+}
+
+
+BalBoa::FrameDecoder::StepResult
+BalBoa::FrameDecoder::Step(byte b)
+{
+	switch (_state)
+	{
+	case dsPrefix:
+		if (b == framePrefix)
+		{
+			_frame[0] = b;
+			_used = 1;
+			_state = dsLength;
+		}
+		break;
+
+	case dsLength:
+		if (b == framePrefix)
+		{
+			//  Back to back 0x7e, we started on the suffix of the previous frame.
+			break;
+		}
+
+		_frame[_used++] = b;
+
+		if ((b < (minFrameLength - 2)) || (b > (maxFrameLength - 2)))
+		{
+			return srBadFrame;
+		}
+
+		_crc = F_CRC_ActualizaCheckSum(INITIAL_VALUE, b);
+		_state = dsBody;
+		break;
+
+	case dsBody:
+		_frame[_used++] = b;
+		_crc = F_CRC_ActualizaCheckSum(_crc, b);
+
+		//  _frame[1] counts itself, the ID, payload and check byte.
+		if (_used == _frame[1])
+		{
+			_state = dsCheck;
+		}
+		break;
+
+	case dsCheck:
+		_frame[_used++] = b;
+
+		if (b != (byte)(_crc ^ FINAL_XOR_VALUE))
+		{
+			return srBadCRC;
+		}
+		_state = dsSuffix;
+		break;
+
+	case dsSuffix:
+		_frame[_used++] = b;
+
+		if (b != frameSuffix)
+		{
+			return srBadFrame;
+		}
+
+		_state = dsPrefix;
+		return srFrame;
+	}
+
+	return srMore;
+}
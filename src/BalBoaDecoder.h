@@ -0,0 +1,102 @@
+//  Incremental decoder for the framing used by BalBoa spas.  Raw bytes are read in bulk
+//  into a ring buffer, then run through a state machine that calculates the check byte
+//  as they go by, so a frame is validated the moment its terminator shows up.  If a frame
+//  turns out to be bad, scanning resumes from the byte after its prefix, so a good frame
+//  hiding behind a bad one isn't lost.
+
+#ifndef _BALBOADECODER_h
+#define _BALBOADECODER_h
+
+namespace BalBoa
+{
+	struct MessageBase;
+
+	class FrameDecoder
+	{
+	public:
+		//  Longest frame accepted, including prefix and suffix.
+		static constexpr byte maxFrameLength = 40;
+
+		//  Raw receive buffer, must be a power of 2 no bigger than 256.
+#if defined(__AVR__)
+		static constexpr unsigned int ringSize = 64;
+#else
+		static constexpr unsigned int ringSize = 256;
+#endif
+
+		FrameDecoder();
+
+		//  Drop all buffered data, wait for the next prefix.
+		void Reset();
+
+		//  Where to put newly received bytes.  'space' is set to how many contiguous
+		//  bytes may be written there, call Received() with the number actually written.
+		byte *ReceiveBuffer(size_t &space);
+		void Received(size_t count);
+
+		//  Returns the next frame from the buffered data that passed all checks, or
+		//  nullptr once the rest of the data is only part of a frame.  The frame stays
+		//  valid until the next call.
+		const MessageBase *NextFrame();
+
+		//  True if no bytes of a partial frame are held.
+		bool Idle() const;
+
+		//  Running total of good frames.
+		unsigned long Frames() const
+		{
+			return _frames;
+		};
+
+		//  Running totals of frames thrown away.
+		unsigned int CRCErrors() const
+		{
+			return _crcErrors;
+		};
+		unsigned int FramingErrors() const
+		{
+			return _framingErrors;
+		};
+
+	private:
+		enum DecodeState : byte
+		{
+			dsPrefix,   //  Looking for 0x7e
+			dsLength,   //  Length, counts from itself through the check byte
+			dsBody,     //  Message ID and payload
+			dsCheck,    //  8 bit CRC of length, ID and payload
+			dsSuffix    //  Terminating 0x7e
+		};
+
+		enum StepResult : byte
+		{
+			srMore,
+			srFrame,
+			srBadFrame,
+			srBadCRC
+		};
+
+		static constexpr byte _ringMask = ringSize - 1;
+
+		StepResult Step(byte);
+		void Resync(StepResult);
+
+		//  _head is the first byte of the frame being decoded, _scan the next byte to be
+		//  fed to the state machine, _tail where new data goes.  All wrap at ringSize, one
+		//  slot is always left free so _head == _tail means empty.
+		byte _ring[ringSize];
+		byte _head;
+		byte _scan;
+		byte _tail;
+
+		DecodeState _state;
+		byte _used;
+		byte _crc;
+		unsigned long _frames = 0;
+		unsigned int _crcErrors = 0;
+		unsigned int _framingErrors = 0;
+		byte _frame[maxFrameLength];
+	};
+}
+
+#endif
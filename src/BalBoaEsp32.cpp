@@ -0,0 +1,129 @@
+//  Non-blocking connect for ESP32, see BalBoaEsp32.h.  Only built for ESP32.
+
+#if defined ARDUINO && defined ARDUINO_ARCH_ESP32
+
+#include "BalBoaPlatform.h"
+
+#include <errno.h>
+#include <lwip/sockets.h>
+
+//  lwip_*() explicitly:  inside a WiFiClient, plain connect() would be its own member.
+
+
+BalBoa::Esp32Client::~Esp32Client()
+{
+	if (_connectingFd >= 0)
+	{
+		lwip_close(_connectingFd);
+	}
+}
+
+
+int
+BalBoa::Esp32Client::connectStart(const IPAddress &ip, uint16_t port)
+{
+	stop();
+
+	const int fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+	sockaddr_in address;
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = (uint32_t)ip;
+	address.sin_port = htons(port);
+
+	if (lwip_connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+	{
+		return Adopt(fd);
+	}
+
+	if (errno != EINPROGRESS)
+	{
+		lwip_close(fd);
+		return -1;
+	}
+
+	_connectingFd = fd;
+
+	return 0;
+}
+
+
+int
+BalBoa::Esp32Client::connectPoll()
+{
+	if (_connectingFd < 0)
+	{
+		return connected() ? 1 : -1;
+	}
+
+	fd_set writable;
+	timeval noWait = {0, 0};
+
+	FD_ZERO(&writable);
+	FD_SET(_connectingFd, &writable);
+
+	const int ready = lwip_select(_connectingFd + 1, nullptr, &writable, nullptr, &noWait);
+
+	if (ready == 0)
+	{
+		return 0;
+	}
+
+	int error = 0;
+	socklen_t errorSize = sizeof(error);
+
+	if ((ready < 0)
+		|| (lwip_getsockopt(_connectingFd, SOL_SOCKET, SO_ERROR, &error, &errorSize) != 0)
+		|| (error != 0))
+	{
+		stop();
+		return -1;
+	}
+
+	const int fd = _connectingFd;
+
+	_connectingFd = -1;
+
+	return Adopt(fd);
+}
+
+
+void
+BalBoa::Esp32Client::stop()
+{
+	if (_connectingFd >= 0)
+	{
+		lwip_close(_connectingFd);
+		_connectingFd = -1;
+	}
+
+	WiFiClient::stop();
+}
+
+
+int
+BalBoa::Esp32Client::Adopt(int fd)
+{
+	//  Back to blocking, as WiFiClient::connect() leaves its sockets; its reads and
+	//  writes expect that.
+	lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+	const int one = 1;
+
+	lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	WiFiClient::operator=(WiFiClient(fd));
+
+	return 1;
+}
+
+#endif
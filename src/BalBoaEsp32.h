@@ -0,0 +1,37 @@
+//  ESP32 TCP client that can connect without blocking loop().
+//
+//  WiFiClient::connect() waits for the handshake, up to its timeout.  The ESP32 core
+//  has lwIP's BSD socket layer underneath, so this opens the socket itself, non-blocking,
+//  and checks on it with a zero-timeout select() from each GetChanges().  Once it's
+//  connected, the socket is handed to WiFiClient, the same as WiFiServer does with an
+//  accepted one, and from then on it's an ordinary WiFiClient.
+
+#ifndef _BALBOAESP32_h
+#define _BALBOAESP32_h
+
+namespace BalBoa
+{
+	class Esp32Client : public WiFiClient
+	{
+	public:
+		Esp32Client() = default;
+		~Esp32Client();
+		Esp32Client(const Esp32Client &) = delete;
+		Esp32Client &operator=(const Esp32Client &) = delete;
+
+		//  Non-blocking connect, like PosixClient's.  Both return 1 once connected, -1 on
+		//  failure, and 0 while still in progress (call connectPoll() again later).
+		int connectStart(const IPAddress &, uint16_t port);
+		int connectPoll();
+
+		void stop() override;
+
+	private:
+		//  Hand the connected socket to WiFiClient.
+		int Adopt(int fd);
+
+		int _connectingFd = -1;
+	};
+}
+
+#endif
@@ -0,0 +1,693 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaGateway.h"
+#include "BalBoaLog.h"
+
+#if defined __linux__ && !defined ARDUINO
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+namespace
+{
+	constexpr int maxEvents = 64;
+}
+
+
+BalBoa::GatewaySpa::GatewaySpa(
+	BalBoa::SpaGateway &gateway,
+	size_t index,
+	const IPAddress &address,
+	uint16_t port)
+	: _gateway(gateway), _index(index), _address(address), _port(port), _epollFd(-1),
+	  _started(false), _connecting(false), _linkLost(false), _connectTime(0),
+	  _reconnect(BALBOA_RECONNECT_MIN, BALBOA_RECONNECT_MAX), _outputUsed(0)
+{
+}
+
+
+BalBoa::SpaStatus
+BalBoa::GatewaySpa::GetStatus() const
+{
+	if (!_started)
+	{
+		return ssIdle;
+	}
+
+	if (_connecting)
+	{
+		return ssConnecting;
+	}
+
+	return Connected() ? ssConnected : ssDisconnected;
+}
+
+
+void
+BalBoa::GatewaySpa::SendMessage(
+	BalBoa::MessageBase *pMessage)
+{
+	pMessage->SetCRC();
+
+	if (pMessage->IsUserCommand())
+	{
+		_reconnect.Now();
+	}
+
+	if (!_queue.Add(pMessage))
+	{
+		BALBOA_LOG_WARN(F("Command queue full!"));
+	}
+
+	if (!Connected())
+	{
+		//  Sends the queue once connected.
+		Connect();
+		return;
+	}
+
+	Flush();
+}
+
+
+void
+BalBoa::GatewaySpa::Connect()
+{
+	if (!_started || _connecting || Connected())
+	{
+		return;
+	}
+
+	if (!_reconnect.Ready(millis()))
+	{
+		return;
+	}
+
+	_connectTime = millis();
+	_reconnect.Attempt(_connectTime);
+
+	int result = _client.connectStart(_address, _port);
+
+	if (result < 0)
+	{
+		ConnectFinished(false);
+		return;
+	}
+
+	//  Edge-triggered, so once registered there's nothing more to change:  reads and
+	//  writes go until EAGAIN, and the next edge says when to carry on.
+	epoll_event event = {};
+
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = this;
+
+	if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _client.fd(), &event) != 0)
+	{
+		ConnectFinished(false);
+		return;
+	}
+
+	if (result == 0)
+	{
+		_connecting = true;
+		return;
+	}
+
+	ConnectFinished(true);
+}
+
+
+void
+BalBoa::GatewaySpa::ConnectFinished(bool connected)
+{
+	SpaGateway::EventThread &thread = _gateway.ThreadFor(*this);
+
+	_connecting = false;
+	_outputUsed = 0;
+
+	if (connected)
+	{
+		BALBOA_TRACE(teConnect, 0);
+		thread.connects.fetch_add(1, std::memory_order_relaxed);
+		thread.connected.fetch_add(1, std::memory_order_relaxed);
+
+		_reconnect.Reset();
+		_linkLost = false;
+
+		OnConnected();
+		Flush();
+	}
+	else
+	{
+		BALBOA_TRACE(teConnectFailed, 0);
+		thread.connectFailures.fetch_add(1, std::memory_order_relaxed);
+
+		_reconnect.Failed();
+
+		_client.stop();
+
+		//  Better to lose them than to have them happen at some random time later.
+		_queue.Clear();
+
+		if (LinkFailed())
+		{
+			//  Lost contact, don't keep showing old values.
+			ResetState();
+			_linkLost = false;
+		}
+	}
+}
+
+
+void
+BalBoa::GatewaySpa::Close()
+{
+	BALBOA_TRACE(teDisconnect, 0);
+
+	if (Connected())
+	{
+		_gateway.ThreadFor(*this).connected.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	//  Closing the socket takes it out of the epoll set too.
+	_client.stop();
+	_connecting = false;
+	_outputUsed = 0;
+}
+
+
+void
+BalBoa::GatewaySpa::HandleEvents(uint32_t events)
+{
+	if (_connecting)
+	{
+		if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+		{
+			return;
+		}
+
+		int result = _client.connectPoll();
+
+		if (result == 0)
+		{
+			return;
+		}
+
+		ConnectFinished(result > 0);
+	}
+
+	if (!Connected())
+	{
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+	{
+		//  Whatever did arrive is processed, even if the connection then closed.
+		bool open = Read();
+
+		if (Changes() && _gateway._changeHandler)
+		{
+			_gateway._changeHandler(*this, _gateway._pChangeContext);
+		}
+
+		if (!open)
+		{
+			Close();
+			return;
+		}
+	}
+
+	if (events & EPOLLOUT)
+	{
+		Flush();
+	}
+}
+
+
+bool
+BalBoa::GatewaySpa::Read()
+{
+	SpaGateway::EventThread &thread = _gateway.ThreadFor(*this);
+	const unsigned long framesBefore = GetDecoder().Frames();
+	size_t total = 0;
+	bool open = true;
+
+	//  Edge-triggered:  must read until the socket is empty, or there'll be no
+	//  further event for what's left.
+	for (;;)
+	{
+		size_t space;
+		byte *pBuffer = ReceiveBuffer(space);
+
+		ssize_t amountRead = recv(_client.fd(), pBuffer, space, MSG_DONTWAIT);
+
+		if (amountRead > 0)
+		{
+			Received((size_t)amountRead);
+			total += amountRead;
+
+			//  Processing a frame may have sent something that failed.
+			if (!Connected())
+			{
+				break;
+			}
+			continue;
+		}
+
+		if (amountRead < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				break;
+			}
+
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			BALBOA_TRACE(teReadError, 0);
+			BALBOA_LOG_ERROR(F("read() error!"));
+		}
+
+		open = false;
+		break;
+	}
+
+	thread.bytes.fetch_add(total, std::memory_order_relaxed);
+	thread.frames.fetch_add(GetDecoder().Frames() - framesBefore, std::memory_order_relaxed);
+
+	return open && Connected();
+}
+
+
+void
+BalBoa::GatewaySpa::Flush()
+{
+	while (Connected())
+	{
+		if (_outputUsed == 0)
+		{
+			if (!_queue.Count())
+			{
+				return;
+			}
+
+			const byte tokens = _sendTokens.Available();
+
+			if (!tokens)
+			{
+				return;
+			}
+
+			//  Everything ready now goes in one write.
+			const byte count = min(tokens, _queue.Count());
+
+			_outputUsed = _queue.Take(count, _output);
+			_sendTokens.Use(count);
+		}
+
+		ssize_t sent = send(_client.fd(), _output, _outputUsed, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				//  The next EPOLLOUT edge brings us back.
+				return;
+			}
+
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			Close();
+			return;
+		}
+
+		_outputUsed -= sent;
+		memmove(_output, _output + sent, _outputUsed);
+	}
+}
+
+
+void
+BalBoa::GatewaySpa::Tick(unsigned long now)
+{
+	if (_connecting)
+	{
+		if ((now - _connectTime) >= _gateway._connectionTimeout)
+		{
+			ConnectFinished(false);
+		}
+		return;
+	}
+
+	//  Sends again anything the spa hasn't acted on, reconnecting if needed.
+	CheckCommands();
+
+	const unsigned long pollingInterval = _gateway._pollingInterval;
+
+	if (Connected())
+	{
+		Flush();
+
+		//  Same rules as BalBoaSpa::GetChanges().
+		if (!ReceivePending() && (pollingInterval > 0) && !_waitingForMessages
+			&& !_queue.Count() && !_outputUsed && !CommandsPending())
+		{
+			Close();
+			return;
+		}
+
+		if (GetLinkState() == lsDead)
+		{
+			BALBOA_TRACE(teTimeout, 0);
+			BALBOA_LOG_ERROR(F("Message timeout!"));
+			_gateway.ThreadFor(*this).timeouts.fetch_add(1, std::memory_order_relaxed);
+
+			Close();
+			_linkLost = true;
+
+			if (LinkFailed())
+			{
+				ResetState();
+				_linkLost = false;
+			}
+		}
+		return;
+	}
+
+	if ((pollingInterval == 0) || _linkLost || ((now - _lastMessageTime) > pollingInterval))
+	{
+		Connect();
+	}
+}
+
+
+BalBoa::SpaGateway::SpaGateway()
+	: _stopping(false), _changeHandler(nullptr), _pChangeContext(nullptr), _pollingInterval(0),
+	  _connectionTimeout(5000)
+{
+}
+
+
+BalBoa::SpaGateway::~SpaGateway()
+{
+	end();
+}
+
+
+BalBoa::GatewaySpa &
+BalBoa::SpaGateway::Add(
+	const IPAddress &address,
+	uint16_t port)
+{
+	_spas.emplace_back(new GatewaySpa(*this, _spas.size(), address, port));
+
+	return *_spas.back();
+}
+
+
+void
+BalBoa::SpaGateway::SetChangeHandler(
+	BalBoa::SpaGateway::ChangeHandler handler,
+	void *pContext)
+{
+	_changeHandler = handler;
+	_pChangeContext = pContext;
+}
+
+
+bool
+BalBoa::SpaGateway::begin(
+	unsigned int threads,
+	unsigned long pollingInterval,
+	unsigned long connectionTimeout)
+{
+	if (!_threads.empty())
+	{
+		return false;
+	}
+
+	if (threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+
+		if (threads == 0)
+		{
+			threads = 1;
+		}
+	}
+
+	_pollingInterval = pollingInterval;
+	_connectionTimeout = connectionTimeout;
+	_stopping = false;
+
+	const itimerspec tick = {{BALBOA_GATEWAY_TICK / 1000, (BALBOA_GATEWAY_TICK % 1000) * 1000000},
+							 {BALBOA_GATEWAY_TICK / 1000, (BALBOA_GATEWAY_TICK % 1000) * 1000000}};
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		_threads.emplace_back(new EventThread);
+
+		EventThread &thread = *_threads.back();
+
+		thread.epollFd = epoll_create1(EPOLL_CLOEXEC);
+		thread.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		thread.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if ((thread.epollFd < 0) || (thread.timerFd < 0) || (thread.wakeFd < 0)
+			|| (timerfd_settime(thread.timerFd, 0, &tick, nullptr) != 0))
+		{
+			BALBOA_LOG_ERROR(F("Can't set up gateway thread"));
+
+			Cleanup();
+			return false;
+		}
+
+		epoll_event event = {};
+
+		event.events = EPOLLIN;
+		event.data.ptr = &thread.timerFd;
+		epoll_ctl(thread.epollFd, EPOLL_CTL_ADD, thread.timerFd, &event);
+
+		event.data.ptr = &thread.wakeFd;
+		epoll_ctl(thread.epollFd, EPOLL_CTL_ADD, thread.wakeFd, &event);
+	}
+
+	for (auto &pSpa : _spas)
+	{
+		EventThread &thread = ThreadFor(*pSpa);
+
+		pSpa->_epollFd = thread.epollFd;
+		pSpa->_started = true;
+		thread.spas.push_back(pSpa.get());
+	}
+
+	for (auto &pThread : _threads)
+	{
+		pThread->thread = std::thread(&SpaGateway::Run, this, std::ref(*pThread));
+	}
+
+	return true;
+}
+
+
+void
+BalBoa::SpaGateway::end()
+{
+	if (_threads.empty())
+	{
+		return;
+	}
+
+	_stopping = true;
+
+	for (auto &pThread : _threads)
+	{
+		const uint64_t wake = 1;
+
+		if (write(pThread->wakeFd, &wake, sizeof(wake)) < 0)
+		{
+			BALBOA_LOG_ERROR(F("Can't wake gateway thread"));
+		}
+	}
+
+	for (auto &pThread : _threads)
+	{
+		if (pThread->thread.joinable())
+		{
+			pThread->thread.join();
+		}
+	}
+
+	for (auto &pSpa : _spas)
+	{
+		pSpa->Close();
+		pSpa->_started = false;
+		pSpa->_epollFd = -1;
+	}
+
+	Cleanup();
+}
+
+
+void
+BalBoa::SpaGateway::Cleanup()
+{
+	for (auto &pThread : _threads)
+	{
+		for (int fd : {pThread->epollFd, pThread->timerFd, pThread->wakeFd})
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+
+	_threads.clear();
+}
+
+
+void
+BalBoa::SpaGateway::Post(
+	BalBoa::GatewaySpa &spa,
+	BalBoa::SpaGateway::SpaFunction function,
+	void *pContext)
+{
+	EventThread &thread = ThreadFor(spa);
+
+	{
+		std::lock_guard<std::mutex> lock(thread.postLock);
+
+		thread.posted.push_back({&spa, function, pContext});
+	}
+
+	const uint64_t wake = 1;
+
+	if (write(thread.wakeFd, &wake, sizeof(wake)) < 0)
+	{
+		BALBOA_LOG_ERROR(F("Can't wake gateway thread"));
+	}
+}
+
+
+BalBoa::SpaGateway::Stats
+BalBoa::SpaGateway::GetStats() const
+{
+	Stats stats = {};
+
+	for (const auto &pThread : _threads)
+	{
+		stats.frames += pThread->frames.load(std::memory_order_relaxed);
+		stats.bytes += pThread->bytes.load(std::memory_order_relaxed);
+		stats.connected += pThread->connected.load(std::memory_order_relaxed);
+		stats.connects += pThread->connects.load(std::memory_order_relaxed);
+		stats.connectFailures += pThread->connectFailures.load(std::memory_order_relaxed);
+		stats.timeouts += pThread->timeouts.load(std::memory_order_relaxed);
+	}
+
+	return stats;
+}
+
+
+BalBoa::SpaGateway::EventThread &
+BalBoa::SpaGateway::ThreadFor(const BalBoa::GatewaySpa &spa)
+{
+	return *_threads[spa.Index() % _threads.size()];
+}
+
+
+void
+BalBoa::SpaGateway::RunPosted(BalBoa::SpaGateway::EventThread &thread)
+{
+	uint64_t count;
+
+	if (read(thread.wakeFd, &count, sizeof(count)) < 0)
+	{
+		return;
+	}
+
+	std::vector<Posted> posted;
+
+	{
+		std::lock_guard<std::mutex> lock(thread.postLock);
+
+		posted.swap(thread.posted);
+	}
+
+	for (const Posted &entry : posted)
+	{
+		entry.function(*entry.pSpa, entry.pContext);
+	}
+}
+
+
+void
+BalBoa::SpaGateway::Run(BalBoa::SpaGateway::EventThread &thread)
+{
+	for (GatewaySpa *pSpa : thread.spas)
+	{
+		pSpa->Connect();
+	}
+
+	epoll_event events[maxEvents];
+
+	while (!_stopping)
+	{
+		int count = epoll_wait(thread.epollFd, events, maxEvents, -1);
+
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			BALBOA_LOG_ERROR(F("epoll_wait() error!"));
+			return;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			void *pTarget = events[i].data.ptr;
+
+			if (pTarget == &thread.timerFd)
+			{
+				uint64_t expirations;
+
+				if (read(thread.timerFd, &expirations, sizeof(expirations)) < 0)
+				{
+					continue;
+				}
+
+				const unsigned long now = millis();
+
+				for (GatewaySpa *pSpa : thread.spas)
+				{
+					pSpa->Tick(now);
+				}
+			}
+			else if (pTarget == &thread.wakeFd)
+			{
+				RunPosted(thread);
+			}
+			else
+			{
+				static_cast<GatewaySpa *>(pTarget)->HandleEvents(events[i].events);
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,212 @@
+//  Linux server-side backend, for a gateway talking to hundreds or thousands of spas.
+//
+//  Each spa (GatewaySpa) is the usual SpaProtocol core on a non-blocking socket.  The
+//  spas are shared out between a fixed number of event threads, each with its own epoll
+//  set and timerfd.  Sockets are edge-triggered:  when data arrives it's read, until the
+//  socket is empty, straight into the spa's frame decoder.  Every BALBOA_GATEWAY_TICK ms
+//  the timerfd wakes the thread to look after connect and message timeouts, polling,
+//  command retries and paced sending.
+//
+//  A spa only ever runs on its own thread, so there's no locking around spa state.  The
+//  flip side is that a spa may only be looked at or sent commands from that thread:  in
+//  the change handler, or in a function handed to Post().
+//
+//  Linux only, and not part of Arduino builds.  Include after BalBoaSpa.h.
+
+#ifndef _BALBOAGATEWAY_h
+#define _BALBOAGATEWAY_h
+
+#if defined __linux__ && !defined ARDUINO
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if !defined BALBOA_GATEWAY_TICK
+#define BALBOA_GATEWAY_TICK 100
+#endif
+
+namespace BalBoa
+{
+	class SpaGateway;
+
+
+	class GatewaySpa : public SpaProtocol
+	{
+	public:
+		const IPAddress &GetSpaIP() const
+		{
+			return _address;
+		};
+
+		//  Order added to the gateway.
+		size_t Index() const
+		{
+			return _index;
+		};
+
+		SpaStatus GetStatus() const;
+
+		//  Connection attempts, and how long until the next.
+		const Backoff &GetReconnectBackoff() const
+		{
+			return _reconnect;
+		};
+
+	protected:
+		void SendMessage(MessageBase *) override;
+
+	private:
+		friend class SpaGateway;
+
+		GatewaySpa(SpaGateway &, size_t index, const IPAddress &, uint16_t port);
+
+		bool Connected() const
+		{
+			return (_client.fd() >= 0) && !_connecting;
+		};
+
+		void Connect();
+		void ConnectFinished(bool connected);
+		void Close();
+		void HandleEvents(uint32_t events);
+		bool Read();
+		void Flush();
+		void Tick(unsigned long now);
+
+		SpaGateway &_gateway;
+		size_t _index;
+		IPAddress _address;
+		uint16_t _port;
+
+		//  Event thread this spa belongs to.
+		int _epollFd;
+
+		SpaClient _client;
+		bool _started;
+		bool _connecting;
+		bool _linkLost;   //  Reconnect straight away
+		unsigned long _connectTime;
+		Backoff _reconnect;   //  Jittered, so a gateway full of spas don't retry together
+
+		CommandQueue _queue;
+		TokenBucket _sendTokens;
+
+		//  Taken from the queue but not yet accepted by the socket.
+		byte _output[BALBOA_SEND_BURST * CommandQueue::maxMessageLength];
+		size_t _outputUsed;
+	};
+
+
+	class SpaGateway
+	{
+	public:
+		//  Running totals, over all event threads.
+		struct Stats
+		{
+			unsigned long long frames;
+			unsigned long long bytes;
+			unsigned long connected;   //  Right now
+			unsigned long connects;
+			unsigned long connectFailures;
+			unsigned long timeouts;
+		};
+
+		//  Called on the spa's event thread after data has arrived, if the spa has changes
+		//  not yet acknowledged.
+		typedef void (*ChangeHandler)(GatewaySpa &, void *pContext);
+
+		//  Run on the spa's event thread, see Post().
+		typedef void (*SpaFunction)(GatewaySpa &, void *pContext);
+
+		SpaGateway();
+		~SpaGateway();
+		SpaGateway(const SpaGateway &) = delete;
+		SpaGateway &operator=(const SpaGateway &) = delete;
+
+		//  All spas are added, and the handler set, before begin().
+		GatewaySpa &Add(const IPAddress &, uint16_t port = 4257);
+		void SetChangeHandler(ChangeHandler, void *pContext);
+
+		//  Starts the event threads (0 for one per core) and connects to every spa.  With
+		//  a polling interval, connections are closed once everything's up to date and
+		//  re-opened after the interval, as with BalBoaSpa.
+		bool begin(unsigned int threads = 1,
+				   unsigned long pollingInterval = 0,       // Milli-seconds
+				   unsigned long connectionTimeout = 5000); // Milli-seconds (TCP connect)
+
+		//  Stops the threads and closes all connections.
+		void end();
+
+		//  Queue 'function' to run on the spa's event thread.  Safe from any thread.
+		void Post(GatewaySpa &, SpaFunction, void *pContext);
+
+		size_t Count() const
+		{
+			return _spas.size();
+		};
+
+		GatewaySpa &operator[](size_t index)
+		{
+			return *_spas[index];
+		};
+
+		unsigned int Threads() const
+		{
+			return (unsigned int)_threads.size();
+		};
+
+		Stats GetStats() const;
+
+	private:
+		friend class GatewaySpa;
+
+		struct Posted
+		{
+			GatewaySpa *pSpa;
+			SpaFunction function;
+			void *pContext;
+		};
+
+		struct EventThread
+		{
+			int epollFd = -1;
+			int timerFd = -1;
+			int wakeFd = -1;   //  eventfd, for Post() and end()
+			std::thread thread;
+			std::vector<GatewaySpa *> spas;
+
+			std::mutex postLock;
+			std::vector<Posted> posted;
+
+			//  Only written by the thread itself.
+			std::atomic<unsigned long long> frames{0};
+			std::atomic<unsigned long long> bytes{0};
+			std::atomic<unsigned long> connected{0};
+			std::atomic<unsigned long> connects{0};
+			std::atomic<unsigned long> connectFailures{0};
+			std::atomic<unsigned long> timeouts{0};
+		};
+
+		void Run(EventThread &);
+		void RunPosted(EventThread &);
+		EventThread &ThreadFor(const GatewaySpa &);
+		void Cleanup();
+
+		std::vector<std::unique_ptr<GatewaySpa>> _spas;
+		std::vector<std::unique_ptr<EventThread>> _threads;
+		std::atomic<bool> _stopping;
+
+		ChangeHandler _changeHandler;
+		void *_pChangeContext;
+
+		unsigned long _pollingInterval;
+		unsigned long _connectionTimeout;
+	};
+}
+
+#endif
+
+#endif
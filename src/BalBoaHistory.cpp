@@ -0,0 +1,301 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaHistory.h"
+
+#if BALBOA_HISTORY_SIZE > 0
+
+namespace
+{
+	//  7 bits at a time, low first, top bit set on all but the last byte.
+	size_t PutVarint(byte *pBuffer, unsigned long value)
+	{
+		size_t length = 0;
+
+		while (value >= 0x80)
+		{
+			pBuffer[length++] = (byte)(value | 0x80);
+			value >>= 7;
+		}
+
+		pBuffer[length++] = (byte)value;
+
+		return length;
+	}
+
+
+	//  Temperatures change by small amounts either way:  0, -1, +1, -2... become 0, 1, 2,
+	//  3..., so most changes fit in one varint byte.  Differences are modulo 256, so
+	//  going to or from UNKNOWN_VAL works too.
+	unsigned int ZigZag(byte from, byte to)
+	{
+		const int difference = (int8_t)(byte)(to - from);
+
+		return (difference >= 0) ? (unsigned int)difference * 2 : (unsigned int)(-difference) * 2 - 1;
+	}
+
+
+	byte UnZigZag(byte from, unsigned long zigZag)
+	{
+		const int difference = (zigZag & 1) ? -(int)((zigZag + 1) >> 1) : (int)(zigZag >> 1);
+
+		return (byte)(from + difference);
+	}
+
+
+	//  2 bits each, 3 for unknown.
+	byte PackSwitch(byte value)
+	{
+		return (value == BalBoa::UNKNOWN_VAL) ? 3 : (value & 3);
+	}
+
+
+	byte UnpackSwitch(byte packed)
+	{
+		return (packed == 3) ? BalBoa::UNKNOWN_VAL : packed;
+	}
+
+
+	byte Switches(const BalBoa::HistorySample &sample)
+	{
+		return PackSwitch(sample.heating)
+			| (PackSwitch(sample.lights) << 2)
+			| (PackSwitch(sample.pump1) << 4)
+			| (PackSwitch(sample.pump2) << 6);
+	}
+}
+
+
+BalBoa::StateHistory::StateHistory()
+	: _start(0), _used(0), _samples(0), _haveBase(false), _latestOffset(0),
+	  _canReplace(false), _edits(0)
+{
+	_base.minute = 0;
+	_base.temp = UNKNOWN_VAL;
+	_base.setPoint = UNKNOWN_VAL;
+	_base.celsiusX2 = false;
+	_base.heating = tsUnknown;
+	_base.lights = tsUnknown;
+	_base.pump1 = psUNKNOWN;
+	_base.pump2 = psUNKNOWN;
+
+	_previous = _base;
+	_latest = _base;
+}
+
+
+void
+BalBoa::StateHistory::Record(unsigned long now, const BalBoa::HistorySample &values)
+{
+	HistorySample sample = values;
+
+	sample.minute = now / 60000;
+
+	if (SameValues(sample, _latest))
+	{
+		return;
+	}
+
+	if ((_samples == 0) && !_haveBase)
+	{
+		//  The very first sample.
+		_base.minute = sample.minute;
+		_latest.minute = sample.minute;
+	}
+
+	if (_canReplace && (sample.minute == _latest.minute))
+	{
+		//  Take the newest sample back out, and store this in its place.
+		_used = (_latestOffset + BALBOA_HISTORY_SIZE - _start) % BALBOA_HISTORY_SIZE;
+		_samples--;
+		_edits++;
+		_latest = _previous;
+		_canReplace = false;
+
+		if (SameValues(sample, _latest))
+		{
+			//  Changed and back again.
+			return;
+		}
+	}
+
+	byte buffer[maxSampleLength];
+
+	Append(buffer, Encode(buffer, _latest, sample));
+
+	_previous = _latest;
+	_latest = sample;
+	_canReplace = true;
+}
+
+
+bool
+BalBoa::StateHistory::SameValues(const BalBoa::HistorySample &a, const BalBoa::HistorySample &b)
+{
+	return (a.temp == b.temp) && (a.setPoint == b.setPoint) && (a.celsiusX2 == b.celsiusX2)
+		&& (Switches(a) == Switches(b));
+}
+
+
+size_t
+BalBoa::StateHistory::Encode(
+	byte *pBuffer,
+	const BalBoa::HistorySample &from,
+	const BalBoa::HistorySample &to)
+{
+	byte header = to.celsiusX2 ? shCelsius : 0;
+	size_t length = 1;
+
+	length += PutVarint(pBuffer + length, to.minute - from.minute);
+
+	if (to.temp != from.temp)
+	{
+		header |= shTemp;
+		length += PutVarint(pBuffer + length, ZigZag(from.temp, to.temp));
+	}
+
+	if (to.setPoint != from.setPoint)
+	{
+		header |= shSetPoint;
+		length += PutVarint(pBuffer + length, ZigZag(from.setPoint, to.setPoint));
+	}
+
+	if (Switches(to) != Switches(from))
+	{
+		header |= shSwitches;
+		pBuffer[length++] = Switches(to);
+	}
+
+	pBuffer[0] = header;
+
+	return length;
+}
+
+
+unsigned long
+BalBoa::StateHistory::Varint(size_t offset, size_t &length) const
+{
+	unsigned long value = 0;
+	byte shift = 0;
+	byte next;
+
+	do
+	{
+		next = At(offset + length++);
+		value |= (unsigned long)(next & 0x7f) << shift;
+		shift += 7;
+	} while (next & 0x80);
+
+	return value;
+}
+
+
+size_t
+BalBoa::StateHistory::Decode(size_t offset, BalBoa::HistorySample &sample) const
+{
+	size_t length = 0;
+	const byte header = At(offset + length++);
+
+	sample.minute += Varint(offset, length);
+	sample.celsiusX2 = (header & shCelsius) != 0;
+
+	if (header & shTemp)
+	{
+		sample.temp = UnZigZag(sample.temp, Varint(offset, length));
+	}
+
+	if (header & shSetPoint)
+	{
+		sample.setPoint = UnZigZag(sample.setPoint, Varint(offset, length));
+	}
+
+	if (header & shSwitches)
+	{
+		const byte switches = At(offset + length++);
+
+		sample.heating = static_cast<TriState>(UnpackSwitch(switches & 3));
+		sample.lights = static_cast<TriState>(UnpackSwitch((switches >> 2) & 3));
+		sample.pump1 = static_cast<PumpSpeed>(UnpackSwitch((switches >> 4) & 3));
+		sample.pump2 = static_cast<PumpSpeed>(UnpackSwitch((switches >> 6) & 3));
+	}
+
+	return length;
+}
+
+
+void
+BalBoa::StateHistory::Append(const byte *pSample, size_t length)
+{
+	while (BALBOA_HISTORY_SIZE - _used < length)
+	{
+		DropOldest();
+	}
+
+	_latestOffset = (_start + _used) % BALBOA_HISTORY_SIZE;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		_ring[(_latestOffset + i) % BALBOA_HISTORY_SIZE] = pSample[i];
+	}
+
+	_used += length;
+	_samples++;
+}
+
+
+void
+BalBoa::StateHistory::DropOldest()
+{
+	const size_t length = Decode(_start, _base);
+
+	_start = (_start + length) % BALBOA_HISTORY_SIZE;
+	_used -= length;
+	_samples--;
+	_haveBase = true;
+	_edits++;
+
+	if (_samples == 0)
+	{
+		//  That was the newest too.
+		_canReplace = false;
+	}
+}
+
+
+BalBoa::StateHistory::Reader::Reader(const BalBoa::StateHistory &history)
+	: _history(history), _sample(history._base), _offset(history._start),
+	  _left(history._used), _edits(history._edits), _base(history._haveBase)
+{
+}
+
+
+bool
+BalBoa::StateHistory::Reader::Next(BalBoa::HistorySample &sample)
+{
+	if (_history._edits != _edits)
+	{
+		return false;
+	}
+
+	if (_base)
+	{
+		_base = false;
+	}
+	else if (_left > 0)
+	{
+		const size_t length = _history.Decode(_offset, _sample);
+
+		_offset = (_offset + length) % BALBOA_HISTORY_SIZE;
+		_left -= length;
+	}
+	else
+	{
+		return false;
+	}
+
+	sample = _sample;
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,139 @@
+//  What the spa has been doing, for charts:  temperature, set point, heater, pumps and
+//  lights over the last day or so.
+//
+//  The status decoder records a sample whenever one of those changes.  Each sample is
+//  stored as the difference from the one before:  a header byte saying which values
+//  changed, the minutes since the previous sample as a varint, then only the values that
+//  changed; temperatures as zig-zag varints of the difference, heater, pumps and lights
+//  packed into one byte.  A typical sample is 3 bytes.  Changes within the same minute
+//  are merged into one sample.  When the ring is full the oldest samples are dropped.
+//
+//  BALBOA_HISTORY_SIZE is the size of the ring in bytes, 0 for none.  The default of
+//  4096 holds a day at one-minute resolution for a spa that changes every minute or two,
+//  usually much more.  Off by default on AVR, which only has 8K of RAM.
+
+#ifndef _BALBOAHISTORY_h
+#define _BALBOAHISTORY_h
+
+#if !defined BALBOA_HISTORY_SIZE
+#if defined ARDUINO_ARCH_AVR
+#define BALBOA_HISTORY_SIZE 0
+#else
+#define BALBOA_HISTORY_SIZE 4096
+#endif
+#endif
+
+#if BALBOA_HISTORY_SIZE > 0
+
+namespace BalBoa
+{
+	//  The spa from one moment on.  Temperatures are in the spa's units, see celsiusX2.
+	struct HistorySample
+	{
+		unsigned long minute;   //  millis() / 60000 when recorded
+		byte temp;
+		byte setPoint;
+		bool celsiusX2;
+		TriState heating;
+		TriState lights;
+		PumpSpeed pump1;
+		PumpSpeed pump2;
+	};
+
+	class StateHistory
+	{
+	public:
+		//  Walks the samples, oldest first, decoding as it goes.
+		class Reader
+		{
+		public:
+			//  False when there are no more, or if recording has since dropped the sample
+			//  that would have been next.
+			bool Next(HistorySample &);
+
+		private:
+			friend class StateHistory;
+
+			explicit Reader(const StateHistory &);
+
+			const StateHistory &_history;
+			HistorySample _sample;
+			size_t _offset;      //  Next sample in the ring
+			size_t _left;        //  Bytes not yet decoded
+			uint32_t _edits;     //  _history._edits when we started
+			bool _base;          //  Still to return _history._base
+		};
+
+		StateHistory();
+
+		//  The spa's values as of 'now' (millis()); 'minute' is ignored.
+		void Record(unsigned long now, const HistorySample &);
+
+		Reader Read() const
+		{
+			return Reader(*this);
+		};
+
+		size_t Samples() const
+		{
+			return _samples + (_haveBase ? 1 : 0);
+		};
+
+		size_t BytesUsed() const
+		{
+			return _used;
+		};
+
+		//  Longest encoding:  header, minutes (32 bits), two temperatures, switches.
+		static constexpr size_t maxSampleLength = 1 + 5 + 2 + 2 + 1;
+
+	private:
+		enum SampleHeader : byte
+		{
+			shTemp = 0x01,
+			shSetPoint = 0x02,
+			shSwitches = 0x04,   //  Heater, lights and pumps, 2 bits each
+			shCelsius = 0x08     //  The value itself, not a change
+		};
+
+		static bool SameValues(const HistorySample &, const HistorySample &);
+		static size_t Encode(byte *pBuffer, const HistorySample &from, const HistorySample &to);
+
+		byte At(size_t offset) const
+		{
+			return _ring[offset % BALBOA_HISTORY_SIZE];
+		};
+
+		//  Reads from offset + length, and adds what it read to length.
+		unsigned long Varint(size_t offset, size_t &length) const;
+
+		//  Apply the sample at 'offset' to 'sample', returns its length.
+		size_t Decode(size_t offset, HistorySample &sample) const;
+		void Append(const byte *pSample, size_t length);
+		void DropOldest();
+
+		byte _ring[BALBOA_HISTORY_SIZE];
+		size_t _start;      //  Oldest sample
+		size_t _used;
+		size_t _samples;    //  In the ring
+
+		//  The state the oldest sample in the ring applies to.  Once something has been
+		//  dropped it's the last sample dropped, and returned first by Reader.
+		HistorySample _base;
+		bool _haveBase;
+
+		//  The newest sample, and what it applies to, so a change within the same minute
+		//  can replace it.
+		HistorySample _previous;
+		HistorySample _latest;
+		size_t _latestOffset;
+		bool _canReplace;
+
+		//  Samples already in the ring dropped or replaced, see Reader::Next().
+		uint32_t _edits;
+	};
+}
+
+#endif
+
+#endif
@@ -0,0 +1,642 @@
+//  POSIX implementations of the Arduino stand-ins in BalBoaHost.h.  Not built on Arduino.
+
+#if !defined ARDUINO && defined __unix__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "BalBoaHost.h"
+
+HostSerial Serial;
+const IPAddress INADDR_NONE(0);
+BalBoa::HostNetworking BalBoa::HostNetwork;
+
+
+unsigned long
+millis()
+{
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long)((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+
+unsigned long
+micros()
+{
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long)((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+
+size_t
+Print::write(const uint8_t *pBuffer, size_t size)
+{
+	size_t written = 0;
+
+	while (size--)
+	{
+		written += write(*pBuffer++);
+	}
+
+	return written;
+}
+
+
+size_t
+Print::write(const char *pString)
+{
+	return write(reinterpret_cast<const uint8_t *>(pString), strlen(pString));
+}
+
+
+size_t
+Print::print(const char *pString)
+{
+	return write(pString);
+}
+
+
+size_t
+Print::print(char c)
+{
+	return write((uint8_t)c);
+}
+
+
+size_t
+Print::print(unsigned char value, int base)
+{
+	return print((unsigned long)value, base);
+}
+
+
+size_t
+Print::print(int value, int base)
+{
+	return print((long)value, base);
+}
+
+
+size_t
+Print::print(unsigned int value, int base)
+{
+	return print((unsigned long)value, base);
+}
+
+
+size_t
+Print::print(long value, int base)
+{
+	if ((base == DEC) || (value >= 0))
+	{
+		char buffer[24];
+
+		snprintf(buffer, sizeof(buffer), (base == DEC) ? "%ld" : "%lX", value);
+
+		return write(buffer);
+	}
+
+	//  Like Arduino, negative numbers in other bases print as unsigned.
+	return print((unsigned long)value, base);
+}
+
+
+size_t
+Print::print(unsigned long value, int base)
+{
+	char buffer[24];
+
+	snprintf(buffer, sizeof(buffer), (base == HEX) ? "%lX" : "%lu", value);
+
+	return write(buffer);
+}
+
+
+size_t
+Print::println()
+{
+	return write("\n");
+}
+
+
+size_t
+Print::println(const char *pString)
+{
+	return print(pString) + println();
+}
+
+
+size_t
+Print::println(char c)
+{
+	return print(c) + println();
+}
+
+
+size_t
+Print::println(unsigned char value, int base)
+{
+	return print(value, base) + println();
+}
+
+
+size_t
+Print::println(int value, int base)
+{
+	return print(value, base) + println();
+}
+
+
+size_t
+Print::println(unsigned int value, int base)
+{
+	return print(value, base) + println();
+}
+
+
+size_t
+Print::println(long value, int base)
+{
+	return print(value, base) + println();
+}
+
+
+size_t
+Print::println(unsigned long value, int base)
+{
+	return print(value, base) + println();
+}
+
+
+size_t
+HostSerial::write(uint8_t c)
+{
+	return (fputc(c, stderr) == EOF) ? 0 : 1;
+}
+
+
+size_t
+HostSerial::write(const uint8_t *pBuffer, size_t size)
+{
+	return fwrite(pBuffer, 1, size, stderr);
+}
+
+
+IPAddress::IPAddress(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+	uint8_t *pBytes = reinterpret_cast<uint8_t *>(&_address);
+
+	pBytes[0] = b1;
+	pBytes[1] = b2;
+	pBytes[2] = b3;
+	pBytes[3] = b4;
+}
+
+
+const char *
+IPAddress::toString(char *pBuffer) const
+{
+	in_addr address;
+
+	address.s_addr = _address;
+
+	return inet_ntop(AF_INET, &address, pBuffer, INET_ADDRSTRLEN);
+}
+
+
+namespace
+{
+	sockaddr_in MakeAddress(const IPAddress &ip, uint16_t port)
+	{
+		sockaddr_in address;
+
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = ip.raw();
+		address.sin_port = htons(port);
+
+		return address;
+	}
+}
+
+
+BalBoa::PosixClient::~PosixClient()
+{
+	stop();
+}
+
+
+int
+BalBoa::PosixClient::connect(
+	const IPAddress &ip,
+	uint16_t port)
+{
+	int result = connectStart(ip, port);
+
+	if (result == 0)
+	{
+		pollfd waitFor = {_fd, POLLOUT, 0};
+
+		poll(&waitFor, 1, (int)_timeout);
+
+		result = connectPoll();
+	}
+
+	if (result <= 0)
+	{
+		stop();
+		return 0;
+	}
+
+	return 1;
+}
+
+
+int
+BalBoa::PosixClient::connectStart(
+	const IPAddress &ip,
+	uint16_t port)
+{
+	stop();
+
+	_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (_fd < 0)
+	{
+		return -1;
+	}
+
+	const int one = 1;
+
+	setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	sockaddr_in address = MakeAddress(ip, port);
+
+	if (::connect(_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+	{
+		return 1;
+	}
+
+	if (errno != EINPROGRESS)
+	{
+		stop();
+		return -1;
+	}
+
+	_connecting = true;
+
+	return 0;
+}
+
+
+int
+BalBoa::PosixClient::connectPoll()
+{
+	if (_fd < 0)
+	{
+		return -1;
+	}
+
+	if (!_connecting)
+	{
+		return 1;
+	}
+
+	pollfd waitFor = {_fd, POLLOUT, 0};
+
+	if (poll(&waitFor, 1, 0) == 0)
+	{
+		return 0;
+	}
+
+	int error = 0;
+	socklen_t errorSize = sizeof(error);
+
+	if ((getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &errorSize) != 0) || (error != 0))
+	{
+		stop();
+		return -1;
+	}
+
+	_connecting = false;
+
+	return 1;
+}
+
+
+uint8_t
+BalBoa::PosixClient::connected()
+{
+	if ((_fd < 0) || _connecting)
+	{
+		return 0;
+	}
+
+	//  Like the Arduino clients, still 'connected' while there is unread data.
+	byte peek;
+	ssize_t result = recv(_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	if ((result == 0) || ((result < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+	{
+		stop();
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void
+BalBoa::PosixClient::stop()
+{
+	if (_fd >= 0)
+	{
+		close(_fd);
+		_fd = -1;
+	}
+
+	_connecting = false;
+}
+
+
+void
+BalBoa::PosixClient::setTimeout(unsigned long milliseconds)
+{
+	_timeout = milliseconds;
+}
+
+
+int
+BalBoa::PosixClient::available()
+{
+	int count = 0;
+
+	if ((_fd < 0) || (ioctl(_fd, FIONREAD, &count) != 0))
+	{
+		return 0;
+	}
+
+	return count;
+}
+
+
+int
+BalBoa::PosixClient::read(byte *pBuffer, size_t size)
+{
+	if (_fd < 0)
+	{
+		return -1;
+	}
+
+	ssize_t result = recv(_fd, pBuffer, size, MSG_DONTWAIT);
+
+	if (result < 0)
+	{
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+	}
+
+	return (int)result;
+}
+
+
+int
+BalBoa::PosixClient::read()
+{
+	byte value;
+
+	return (read(&value, 1) == 1) ? value : -1;
+}
+
+
+size_t
+BalBoa::PosixClient::write(const byte *pBuffer, size_t size)
+{
+	if (_fd < 0)
+	{
+		return 0;
+	}
+
+	ssize_t result = send(_fd, pBuffer, size, MSG_NOSIGNAL);
+
+	return (result < 0) ? 0 : (size_t)result;
+}
+
+
+BalBoa::PosixUdp::~PosixUdp()
+{
+	stop();
+}
+
+
+uint8_t
+BalBoa::PosixUdp::begin(uint16_t port)
+{
+	stop();
+
+	_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (_fd < 0)
+	{
+		return 0;
+	}
+
+	const int one = 1;
+
+	setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+	//  A discovery broadcast gets an answer from every spa on the network, all at once.
+	//  The kernel caps this at net.core.rmem_max.
+	const int receiveBuffer = 1024 * 1024;
+
+	setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+
+	sockaddr_in address = MakeAddress(IPAddress(), port);
+
+	if (bind(_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		stop();
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void
+BalBoa::PosixUdp::stop()
+{
+	if (_fd >= 0)
+	{
+		close(_fd);
+		_fd = -1;
+	}
+
+	_sendUsed = 0;
+	_receiveUsed = _receiveRead = 0;
+}
+
+
+int
+BalBoa::PosixUdp::beginPacket(
+	const IPAddress &ip,
+	uint16_t port)
+{
+	_sendIP = ip;
+	_sendPort = port;
+	_sendUsed = 0;
+
+	return (_fd >= 0) ? 1 : 0;
+}
+
+
+size_t
+BalBoa::PosixUdp::write(uint8_t value)
+{
+	return write(&value, 1);
+}
+
+
+size_t
+BalBoa::PosixUdp::write(
+	const uint8_t *pBuffer,
+	size_t size)
+{
+	size = min(size, sizeof(_sendBuffer) - _sendUsed);
+
+	memcpy(_sendBuffer + _sendUsed, pBuffer, size);
+	_sendUsed += size;
+
+	return size;
+}
+
+
+int
+BalBoa::PosixUdp::endPacket()
+{
+	sockaddr_in address = MakeAddress(_sendIP, _sendPort);
+
+	ssize_t result = sendto(_fd, _sendBuffer, _sendUsed, 0,
+							reinterpret_cast<sockaddr *>(&address), sizeof(address));
+
+	_sendUsed = 0;
+
+	return (result < 0) ? 0 : 1;
+}
+
+
+int
+BalBoa::PosixUdp::parsePacket()
+{
+	if (_fd < 0)
+	{
+		return 0;
+	}
+
+	sockaddr_in from;
+	socklen_t fromSize = sizeof(from);
+
+	ssize_t result = recvfrom(_fd, _receiveBuffer, sizeof(_receiveBuffer), MSG_DONTWAIT,
+							  reinterpret_cast<sockaddr *>(&from), &fromSize);
+
+	if (result <= 0)
+	{
+		_receiveUsed = _receiveRead = 0;
+		return 0;
+	}
+
+	_remoteIP = IPAddress(from.sin_addr.s_addr);
+	_remotePort = ntohs(from.sin_port);
+	_receiveUsed = (size_t)result;
+	_receiveRead = 0;
+
+	return (int)_receiveUsed;
+}
+
+
+int
+BalBoa::PosixUdp::available()
+{
+	return (int)(_receiveUsed - _receiveRead);
+}
+
+
+int
+BalBoa::PosixUdp::read(
+	uint8_t *pBuffer,
+	size_t size)
+{
+	size = min(size, _receiveUsed - _receiveRead);
+
+	memcpy(pBuffer, _receiveBuffer + _receiveRead, size);
+	_receiveRead += size;
+
+	return (int)size;
+}
+
+
+int
+BalBoa::PosixUdp::read(
+	char *pBuffer,
+	size_t size)
+{
+	return read(reinterpret_cast<uint8_t *>(pBuffer), size);
+}
+
+
+void
+BalBoa::PosixUdp::flush()
+{
+	_receiveUsed = _receiveRead = 0;
+}
+
+
+IPAddress
+BalBoa::HostNetworking::localIP()
+{
+	if (_localIP == IPAddress())
+	{
+		ifaddrs *pInterfaces;
+
+		if (getifaddrs(&pInterfaces) == 0)
+		{
+			for (ifaddrs *pInterface = pInterfaces; pInterface; pInterface = pInterface->ifa_next)
+			{
+				if (pInterface->ifa_addr && (pInterface->ifa_addr->sa_family == AF_INET)
+					&& !(pInterface->ifa_flags & IFF_LOOPBACK))
+				{
+					_localIP = IPAddress(reinterpret_cast<sockaddr_in *>(pInterface->ifa_addr)->sin_addr.s_addr);
+					break;
+				}
+			}
+
+			freeifaddrs(pInterfaces);
+		}
+	}
+
+	return _localIP;
+}
+
+
+void
+BalBoa::HostNetworking::setLocalIP(const IPAddress &ip)
+{
+	_localIP = ip;
+}
+
+#endif
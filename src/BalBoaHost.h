@@ -0,0 +1,236 @@
+//  Stand-ins for the Arduino pieces the library uses, so it builds as an ordinary library
+//  on Linux and other POSIX hosts.  Only what BalBoaSpa needs is here:  byte, F(), millis(),
+//  Print (with 'Serial' writing to stderr), IPAddress, and blocking-style TCP/UDP client
+//  classes shaped like WiFiClient / WiFiUDP, built on BSD sockets.
+
+#ifndef _BALBOAHOST_h
+#define _BALBOAHOST_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+//  <netinet/in.h> defines INADDR_NONE as a macro, Arduino code expects an IPAddress.
+#include <netinet/in.h>
+#undef INADDR_NONE
+
+typedef uint8_t byte;
+
+#define F(string)                   (string)
+#define PROGMEM
+#define pgm_read_byte(addr)         (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)         (*(const uint16_t *)(addr))
+#define memcpy_P(to, from, size)    memcpy((to), (from), (size))
+
+#define DEC 10
+#define HEX 16
+
+using std::min;
+using std::max;
+
+//  Milli- and micro-seconds since start-up, from CLOCK_MONOTONIC.  Wrap like the Arduino
+//  ones do where unsigned long is 32 bits.
+unsigned long millis();
+unsigned long micros();
+
+
+class Print
+{
+public:
+	virtual size_t write(uint8_t) = 0;
+	virtual size_t write(const uint8_t *pBuffer, size_t size);
+	size_t write(const char *pString);
+
+	size_t print(const char *);
+	size_t print(char);
+	size_t print(unsigned char, int = DEC);
+	size_t print(int, int = DEC);
+	size_t print(unsigned int, int = DEC);
+	size_t print(long, int = DEC);
+	size_t print(unsigned long, int = DEC);
+
+	size_t println();
+	size_t println(const char *);
+	size_t println(char);
+	size_t println(unsigned char, int = DEC);
+	size_t println(int, int = DEC);
+	size_t println(unsigned int, int = DEC);
+	size_t println(long, int = DEC);
+	size_t println(unsigned long, int = DEC);
+
+protected:
+	~Print() = default;
+};
+
+
+//  Log output, goes to stderr.
+class HostSerial : public Print
+{
+public:
+	size_t write(uint8_t) override;
+	size_t write(const uint8_t *pBuffer, size_t size) override;
+	using Print::write;
+
+	explicit operator bool() const
+	{
+		return true;
+	};
+};
+
+extern HostSerial Serial;
+
+
+class IPAddress
+{
+public:
+	constexpr IPAddress()
+		: _address(0)
+	{};
+	IPAddress(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4);
+
+	//  Network byte order, as in sockaddr_in.sin_addr.s_addr.
+	explicit constexpr IPAddress(uint32_t address)
+		: _address(address)
+	{};
+
+	uint32_t raw() const
+	{
+		return _address;
+	};
+
+	uint8_t operator[](int index) const
+	{
+		return reinterpret_cast<const uint8_t *>(&_address)[index];
+	};
+	uint8_t &operator[](int index)
+	{
+		return reinterpret_cast<uint8_t *>(&_address)[index];
+	};
+
+	bool operator==(const IPAddress &other) const
+	{
+		return _address == other._address;
+	};
+	bool operator!=(const IPAddress &other) const
+	{
+		return _address != other._address;
+	};
+
+	//  Dotted quad, into a buffer of at least 16 chars.
+	const char *toString(char *pBuffer) const;
+
+private:
+	uint32_t _address;
+};
+
+//  0.0.0.0, as in the Arduino cores.
+extern const IPAddress INADDR_NONE;
+
+
+namespace BalBoa
+{
+	//  Shaped like WiFiClient / EthernetClient.
+	class PosixClient
+	{
+	public:
+		PosixClient() = default;
+		~PosixClient();
+		PosixClient(const PosixClient &) = delete;
+		PosixClient &operator=(const PosixClient &) = delete;
+
+		//  Blocks for up to the time set with setTimeout().  Returns 1 on success.
+		int connect(const IPAddress &, uint16_t port);
+
+		//  Non-blocking connect.  Both return 1 once connected, -1 on failure, and 0
+		//  while still in progress (call connectPoll() again later).
+		int connectStart(const IPAddress &, uint16_t port);
+		int connectPoll();
+
+		//  False until a connect has completed.
+		uint8_t connected();
+		void stop();
+		void setTimeout(unsigned long milliseconds);
+
+		int available();
+		int read(byte *pBuffer, size_t size);
+		int read();
+		size_t write(const byte *pBuffer, size_t size);
+
+		int fd() const
+		{
+			return _fd;
+		};
+
+	private:
+		int _fd = -1;
+		bool _connecting = false;
+		unsigned long _timeout = 1000;
+	};
+
+
+	//  Shaped like WiFiUDP / EthernetUDP.
+	class PosixUdp
+	{
+	public:
+		PosixUdp() = default;
+		~PosixUdp();
+		PosixUdp(const PosixUdp &) = delete;
+		PosixUdp &operator=(const PosixUdp &) = delete;
+
+		uint8_t begin(uint16_t port);
+		void stop();
+
+		int beginPacket(const IPAddress &, uint16_t port);
+		size_t write(uint8_t);
+		size_t write(const uint8_t *pBuffer, size_t size);
+		int endPacket();
+
+		//  Non-blocking.  Returns the size of the next datagram, or 0.
+		int parsePacket();
+		int available();
+		int read(char *pBuffer, size_t size);
+		int read(uint8_t *pBuffer, size_t size);
+		IPAddress remoteIP() const
+		{
+			return _remoteIP;
+		};
+		uint16_t remotePort() const
+		{
+			return _remotePort;
+		};
+		void flush();
+
+	private:
+		int _fd = -1;
+
+		IPAddress _sendIP;
+		uint16_t _sendPort = 0;
+		size_t _sendUsed = 0;
+		uint8_t _sendBuffer[64];
+
+		IPAddress _remoteIP;
+		uint16_t _remotePort = 0;
+		size_t _receiveUsed = 0;
+		size_t _receiveRead = 0;
+		uint8_t _receiveBuffer[512];
+	};
+
+
+	//  Plays the part of the WiFi / Ethernet objects.  Discovery broadcasts to the /24
+	//  around localIP(), which defaults to the first non-loopback IPv4 interface.
+	//  setLocalIP(127.0.0.1) makes discovery find simulated spas on the loopback.
+	class HostNetworking
+	{
+	public:
+		IPAddress localIP();
+		void setLocalIP(const IPAddress &);
+
+	private:
+		IPAddress _localIP;
+	};
+
+	extern HostNetworking HostNetwork;
+}
+
+#endif
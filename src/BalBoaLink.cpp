@@ -0,0 +1,242 @@
+
+#include <math.h>
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaLink.h"
+
+namespace
+{
+	//  The chance of a gap longer than mean + y standard deviations, from a normal
+	//  distribution, is close to 1 / (1 + e^(y (a + b y^2))).
+	constexpr float logisticA = 1.5976f;
+	constexpr float logisticB = 0.070566f;
+
+	//  How many standard deviations past the mean a gap has to be for phi to reach
+	//  'phi':  y (a + b y^2) = ln(10^phi - 1) is a cubic with one real root.  Only
+	//  depends on the threshold, so it's worked out when that's set, not per message.
+	float Deviations(float phi)
+	{
+		const float z = logf(powf(10, phi) - 1);
+		const float p = logisticA / logisticB;
+		const float q = -z / logisticB;
+		const float root = sqrtf(q * q / 4 + p * p * p / 27);
+
+		return cbrtf(-q / 2 + root) + cbrtf(-q / 2 - root);
+	}
+}
+
+
+BalBoa::LinkMonitor::LinkMonitor()
+	: _suspectY(Deviations(BALBOA_LINK_SUSPECT)), _deadY(Deviations(BALBOA_LINK_DEAD))
+{
+	Reset();
+}
+
+
+void
+BalBoa::LinkMonitor::Reset()
+{
+	_mean = 0;
+	_variance = 0;
+	_samples = 0;
+	_failures = 0;
+	_haveLast = false;
+	_last = 0;
+	_suspectAfter = BALBOA_LINK_TIMEOUT / 2;
+	_deadAfter = BALBOA_LINK_TIMEOUT;
+}
+
+
+void
+BalBoa::LinkMonitor::Connected(unsigned long now)
+{
+	//  The wait for the first message isn't a gap in the cadence.
+	_haveLast = false;
+	_last = now;
+}
+
+
+void
+BalBoa::LinkMonitor::Arrived(unsigned long now)
+{
+	_failures = 0;
+
+	if (_haveLast)
+	{
+		const float gap = (float)(now - _last);
+
+		if (_samples < 255)
+		{
+			_samples++;
+		}
+
+		//  A plain average to start with, then weighted towards the latest.
+		const float alpha = (_samples < 8) ? 1.0f / _samples : 0.125f;
+		const float difference = gap - _mean;
+
+		_mean += alpha * difference;
+		_variance = (1 - alpha) * (_variance + alpha * difference * difference);
+
+		//  With gaps that barely vary these decay towards 0 and get stuck as denormals,
+		//  which are very slow on most FPUs.  Less than a micro-second is nothing.
+		if (_mean < 0.001f)
+		{
+			_mean = 0;
+		}
+		if (_variance < 0.001f)
+		{
+			_variance = 0;
+		}
+
+		UpdateDeadlines();
+	}
+
+	_haveLast = true;
+	_last = now;
+}
+
+
+bool
+BalBoa::LinkMonitor::Failed()
+{
+	if (_failures < 255)
+	{
+		_failures++;
+	}
+
+	return _failures >= BALBOA_LINK_RETRIES;
+}
+
+
+BalBoa::LinkState
+BalBoa::LinkMonitor::Check(unsigned long now) const
+{
+	const unsigned long silence = now - _last;
+
+	if (!Learned())
+	{
+		return (silence >= BALBOA_LINK_TIMEOUT) ? lsDead : lsUp;
+	}
+
+	if (silence >= _deadAfter)
+	{
+		return lsDead;
+	}
+
+	return (silence >= _suspectAfter) ? lsSuspect : lsUp;
+}
+
+
+float
+BalBoa::LinkMonitor::Jitter() const
+{
+	const float deviation = sqrtf(_variance);
+
+	return (deviation > BALBOA_LINK_MIN_JITTER) ? deviation : BALBOA_LINK_MIN_JITTER;
+}
+
+
+float
+BalBoa::LinkMonitor::Phi(unsigned long now) const
+{
+	if (!Learned())
+	{
+		return 0;
+	}
+
+	const float y = ((float)(now - _last) - _mean) / Jitter();
+	const float e = expf(-y * (logisticA + logisticB * y * y));
+
+	//  Both the same, but each keeps its precision on its own side of the mean.
+	if (y > 0)
+	{
+		return -log10f(e / (1 + e));
+	}
+
+	return -log10f(1 - 1 / (1 + e));
+}
+
+
+void
+BalBoa::LinkMonitor::SetThresholds(float suspect, float dead)
+{
+	_suspectY = Deviations(suspect);
+	_deadY = Deviations(dead);
+
+	if (_samples > 0)
+	{
+		UpdateDeadlines();
+	}
+}
+
+
+void
+BalBoa::LinkMonitor::UpdateDeadlines()
+{
+	//  Phi rises with the silence, so rather than work it out on every check, find the
+	//  silence at which it reaches each threshold.
+	const float jitter = Jitter();
+
+	_suspectAfter = Deadline(_mean + _suspectY * jitter);
+	_deadAfter = Deadline(_mean + _deadY * jitter);
+}
+
+
+unsigned long
+BalBoa::LinkMonitor::Deadline(float deadline)
+{
+	if (deadline <= 0)
+	{
+		return 0;
+	}
+
+	return (deadline < BALBOA_LINK_TIMEOUT) ? (unsigned long)deadline : BALBOA_LINK_TIMEOUT;
+}
+
+
+BalBoa::Backoff::Backoff(unsigned long first, unsigned long most)
+	: _first(first), _most(most), _base(0), _wait(0), _last(0), _attempts(0), _failures(0),
+	  _waiting(false), _random((uint32_t)(uintptr_t)this)
+{
+}
+
+
+void
+BalBoa::Backoff::Reset()
+{
+	_base = 0;
+	_failures = 0;
+	_waiting = false;
+}
+
+
+void
+BalBoa::Backoff::Attempt(unsigned long now)
+{
+	_last = now;
+	_attempts++;
+}
+
+
+void
+BalBoa::Backoff::Failed()
+{
+	_failures++;
+	_base = (_base == 0) ? _first : min(_base * 2, _most);
+
+	//  The same firmware has the same addresses, so stir in when this happened too.
+	_random ^= (uint32_t)micros();
+	if (_random == 0)
+	{
+		_random = 1;
+	}
+
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+
+	//  3/4 to 5/4 of the base, the same on average.
+	_wait = _base - _base / 4 + _random % (_base / 2 + 1);
+	_waiting = true;
+}
@@ -0,0 +1,187 @@
+//  Notices a dead connection from the spa's own rhythm, rather than a fixed timeout.
+//
+//  Connected, the spa sends a status message at a steady cadence (about once a second).
+//  LinkMonitor keeps moving averages of the time between them and of its variance, and
+//  from those, as in a phi accrual failure detector, how unlikely the current silence
+//  is:  phi is -log10 of the chance that the next message is still on its way, so phi 3
+//  is a 1 in 1000 chance.  Past BALBOA_LINK_SUSPECT the link is suspect, past
+//  BALBOA_LINK_DEAD it's taken to be dead and the connection is closed and re-opened.
+//  With a 1 second cadence and little jitter that's about 1.5 seconds of silence.
+//
+//  Until a few gaps have been measured, and while waiting for the first message after
+//  connecting, BALBOA_LINK_TIMEOUT ms of silence is dead, as is anything longer once
+//  learned.  BALBOA_LINK_MIN_JITTER keeps a very regular spa from being declared dead
+//  the moment a message is a little late.  BALBOA_LINK_RETRIES failed connections or
+//  dead links in a row (with no status in between) and the spa is lost:  its state goes
+//  back to unknown.
+//
+//  Backoff spaces out retries, of connecting and of discovery, so an unreachable spa
+//  isn't hammered:  each failure doubles the wait, from BALBOA_RECONNECT_MIN up to
+//  BALBOA_RECONNECT_MAX ms for connecting, give or take a random quarter so a room full
+//  of controllers don't all retry at once.  A command from the user skips the wait.
+
+#ifndef _BALBOALINK_h
+#define _BALBOALINK_h
+
+#if !defined BALBOA_LINK_SUSPECT
+#define BALBOA_LINK_SUSPECT 3.0f
+#endif
+
+#if !defined BALBOA_LINK_DEAD
+#define BALBOA_LINK_DEAD 8.0f
+#endif
+
+#if !defined BALBOA_LINK_MIN_JITTER
+#define BALBOA_LINK_MIN_JITTER 100   //  Milli-seconds
+#endif
+
+#if !defined BALBOA_LINK_TIMEOUT
+#define BALBOA_LINK_TIMEOUT 5000     //  Milli-seconds
+#endif
+
+#if !defined BALBOA_LINK_RETRIES
+#define BALBOA_LINK_RETRIES 3
+#endif
+
+#if !defined BALBOA_RECONNECT_MIN
+#define BALBOA_RECONNECT_MIN 1000    //  Milli-seconds
+#endif
+
+#if !defined BALBOA_RECONNECT_MAX
+#define BALBOA_RECONNECT_MAX 60000   //  Milli-seconds
+#endif
+
+namespace BalBoa
+{
+	enum LinkState : byte
+	{
+		lsUp,
+		lsSuspect,   //  Later than usual
+		lsDead       //  Time to reconnect
+	};
+
+
+	class LinkMonitor
+	{
+	public:
+		LinkMonitor();
+
+		//  Forget everything learned.
+		void Reset();
+
+		//  A connection has just been made.
+		void Connected(unsigned long now);
+
+		//  A status message has arrived.
+		void Arrived(unsigned long now);
+
+		//  A connection attempt failed or the link died.  True once that's happened
+		//  BALBOA_LINK_RETRIES times without a status message in between.
+		bool Failed();
+
+		LinkState Check(unsigned long now) const;
+
+		//  How unlikely the silence since the last message is, 0 until learned.
+		float Phi(unsigned long now) const;
+
+		//  Phi thresholds, BALBOA_LINK_SUSPECT and BALBOA_LINK_DEAD by default.
+		void SetThresholds(float suspect, float dead);
+
+		//  What's been learned, milli-seconds.
+		float MeanInterval() const
+		{
+			return _mean;
+		};
+		float Jitter() const;
+		unsigned long SuspectAfter() const
+		{
+			return _suspectAfter;
+		};
+		unsigned long DeadAfter() const
+		{
+			return _deadAfter;
+		};
+
+	private:
+		//  Gaps to measure before trusting the averages.
+		static constexpr byte warmUp = 4;
+
+		bool Learned() const
+		{
+			return _haveLast && (_samples >= warmUp);
+		};
+
+		void UpdateDeadlines();
+		static unsigned long Deadline(float deadline);
+
+		float _mean;
+		float _variance;
+		byte _samples;
+		byte _failures;
+		bool _haveLast;   //  Since connecting
+		unsigned long _last;
+
+		//  Standard deviations past the mean for each phi threshold.
+		float _suspectY;
+		float _deadY;
+
+		//  Silence, in ms, that takes phi past each threshold.
+		unsigned long _suspectAfter;
+		unsigned long _deadAfter;
+	};
+
+
+	class Backoff
+	{
+	public:
+		//  Waits start at 'first' and double up to 'most', milli-seconds.
+		Backoff(unsigned long first, unsigned long most);
+
+		//  It worked, no more waiting.
+		void Reset();
+
+		//  Trying now.
+		void Attempt(unsigned long now);
+
+		//  That didn't work, wait before the next attempt.
+		void Failed();
+
+		//  Skip the current wait, e.g. the user wants something done.
+		void Now()
+		{
+			_waiting = false;
+		};
+
+		bool Ready(unsigned long now) const
+		{
+			return !_waiting || ((now - _last) >= _wait);
+		};
+
+		//  For monitoring.
+		unsigned long Attempts() const   //  Ever
+		{
+			return _attempts;
+		};
+		unsigned long Failures() const   //  In a row
+		{
+			return _failures;
+		};
+		unsigned long Wait() const       //  Current wait, 0 if none
+		{
+			return _waiting ? _wait : 0;
+		};
+
+	private:
+		unsigned long _first;
+		unsigned long _most;
+		unsigned long _base;   //  Before jitter
+		unsigned long _wait;
+		unsigned long _last;
+		unsigned long _attempts;
+		unsigned long _failures;
+		bool _waiting;
+		uint32_t _random;      //  xorshift state, never 0
+	};
+}
+
+#endif
@@ -0,0 +1,63 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaLog.h"
+
+Print *BalBoa::LogOutput = &Serial;
+
+
+void
+BalBoa::DumpHex(
+	Print &output,
+	const byte *pData,
+	size_t size)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	constexpr size_t bytesPerLine = 16;
+
+	char line[bytesPerLine * 3 + 1];
+
+	output.print(F("Dump - # bytes: "));
+	output.println(size);
+
+	for (size_t start = 0; start < size; start += bytesPerLine)
+	{
+		const size_t count = min(size - start, bytesPerLine);
+		char *pOut = line;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			*pOut++ = digits[pData[start + i] >> 4];
+			*pOut++ = digits[pData[start + i] & 0x0f];
+			*pOut++ = ' ';
+		}
+		*pOut = '\0';
+
+		output.println(line);
+	}
+}
+
+
+#if BALBOA_TRACE_SIZE > 0
+BalBoa::TraceEntry BalBoa::TraceRing[BALBOA_TRACE_SIZE];
+unsigned int BalBoa::TraceNext = 0;
+
+
+void
+BalBoa::TraceDump(Print &output)
+{
+	const unsigned int count = min(TraceNext, (unsigned int)BALBOA_TRACE_SIZE);
+
+	for (unsigned int i = TraceNext - count; i != TraceNext; i++)
+	{
+		const TraceEntry &entry = TraceRing[i & (BALBOA_TRACE_SIZE - 1)];
+
+		output.print(entry.time);
+		output.print(' ');
+		output.print((int)entry.event);
+		output.print(' ');
+		output.println(entry.payload, HEX);
+	}
+
+	TraceNext = 0;
+}
+#endif
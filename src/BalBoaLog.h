@@ -0,0 +1,134 @@
+//  Diagnostics for the BalBoa library.
+//
+//  Logging:  Text messages go to BalBoa::LogOutput (Serial by default).  Each message has
+//  a level, and anything above BALBOA_LOG_LEVEL is compiled out completely - the
+//  arguments aren't even evaluated.  Define BALBOA_LOG_LEVEL before including the library
+//  (or on the compiler command line) to change it.
+//
+//  Tracing:  For timing sensitive problems, BALBOA_TRACE_SIZE > 0 keeps a ring of the
+//  last BALBOA_TRACE_SIZE events in RAM.  Recording an event is a few stores, nothing is
+//  printed until TraceDump() is called.
+
+#ifndef _BALBOALOG_h
+#define _BALBOALOG_h
+
+#define BALBOA_LEVEL_NONE   0
+#define BALBOA_LEVEL_ERROR  1   //  Lost connection, read failures
+#define BALBOA_LEVEL_WARN   2   //  Damaged or dropped frames
+#define BALBOA_LEVEL_INFO   3   //  Unexpected but harmless
+#define BALBOA_LEVEL_DEBUG  4   //  Chatty, frame dumps
+
+#ifndef BALBOA_LOG_LEVEL
+#define BALBOA_LOG_LEVEL    BALBOA_LEVEL_WARN
+#endif
+
+//  Must be 0 (off) or a power of 2.
+#ifndef BALBOA_TRACE_SIZE
+#define BALBOA_TRACE_SIZE   0
+#endif
+
+#define BALBOA_LOG_AT(level, message)                   \
+	do                                                  \
+	{                                                   \
+		if ((BALBOA_LOG_LEVEL >= (level)) && BalBoa::LogOutput) \
+		{                                               \
+			BalBoa::LogOutput->println(message);        \
+		}                                               \
+	} while (0)
+
+#if BALBOA_LOG_LEVEL >= BALBOA_LEVEL_ERROR
+#define BALBOA_LOG_ERROR(message)   BALBOA_LOG_AT(BALBOA_LEVEL_ERROR, message)
+#else
+#define BALBOA_LOG_ERROR(message)   do {} while (0)
+#endif
+
+#if BALBOA_LOG_LEVEL >= BALBOA_LEVEL_WARN
+#define BALBOA_LOG_WARN(message)    BALBOA_LOG_AT(BALBOA_LEVEL_WARN, message)
+#else
+#define BALBOA_LOG_WARN(message)    do {} while (0)
+#endif
+
+#if BALBOA_LOG_LEVEL >= BALBOA_LEVEL_INFO
+#define BALBOA_LOG_INFO(message)    BALBOA_LOG_AT(BALBOA_LEVEL_INFO, message)
+#else
+#define BALBOA_LOG_INFO(message)    do {} while (0)
+#endif
+
+#if BALBOA_LOG_LEVEL >= BALBOA_LEVEL_DEBUG
+#define BALBOA_LOG_DEBUG(message)   BALBOA_LOG_AT(BALBOA_LEVEL_DEBUG, message)
+#else
+#define BALBOA_LOG_DEBUG(message)   do {} while (0)
+#endif
+
+//  Hex dump of a frame (or part of one), at the given level.
+#define BALBOA_LOG_DUMP(level, pFrame, size)            \
+	do                                                  \
+	{                                                   \
+		if ((BALBOA_LOG_LEVEL >= (level)) && BalBoa::LogOutput) \
+		{                                               \
+			BalBoa::DumpHex(*BalBoa::LogOutput, (const byte *)(pFrame), (size)); \
+		}                                               \
+	} while (0)
+
+#if BALBOA_TRACE_SIZE > 0
+#define BALBOA_TRACE(event, payload)    BalBoa::TraceRecord((event), (payload))
+#else
+#define BALBOA_TRACE(event, payload)    do {} while (0)
+#endif
+
+class Print;
+
+namespace BalBoa
+{
+	//  Where log messages go, set to nullptr to silence at run-time.
+	extern Print *LogOutput;
+
+	//  Prints 'size' bytes as hex, 16 to a line.  Each line is formatted in a local
+	//  buffer and handed to the output in a single write.
+	void DumpHex(Print &, const byte *, size_t size);
+
+	enum TraceEvent : byte
+	{
+		teConnect,         //  payload: 0
+		teDisconnect,      //  payload: 0
+		teConnectFailed,   //  payload: 0
+		teFrame,           //  payload: message ID bytes 2 & 3
+		teCRCError,        //  payload: frame length
+		teFramingError,    //  payload: bytes held when rejected
+		teReadError,       //  payload: 0
+		teTimeout,         //  payload: 0
+		teUnknownMessage,  //  payload: message ID bytes 2 & 3
+		teSend,            //  payload: message ID bytes 2 & 3
+		teDiscoverySent,   //  payload: retry interval in ms
+		teDiscovered       //  payload: last byte of the spa's address
+	};
+
+#if BALBOA_TRACE_SIZE > 0
+	static_assert((BALBOA_TRACE_SIZE & (BALBOA_TRACE_SIZE - 1)) == 0,
+				  "BALBOA_TRACE_SIZE must be a power of 2");
+
+	struct TraceEntry
+	{
+		unsigned long time;    //  millis()
+		uint16_t payload;
+		TraceEvent event;
+	};
+
+	extern TraceEntry TraceRing[BALBOA_TRACE_SIZE];
+	extern unsigned int TraceNext;
+
+	inline void TraceRecord(TraceEvent event, uint16_t payload)
+	{
+		TraceEntry &entry = TraceRing[TraceNext++ & (BALBOA_TRACE_SIZE - 1)];
+
+		entry.time = millis();
+		entry.payload = payload;
+		entry.event = event;
+	}
+
+	//  Print the recorded events, oldest first, and empty the ring.
+	void TraceDump(Print &);
+#endif
+}
+
+#endif
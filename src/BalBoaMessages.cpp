@@ -1,13 +1,14 @@
-#include <Arduino.h>
+#include "BalBoaPlatform.h"
 #include "crc.h"
 #include "BalBoaSpa.h"
 #include "BalBoaMessages.h"
+#include "BalBoaLog.h"
 
-BalBoa::MessageBase::MessageBase(size_t size, unsigned long messageType)
+BalBoa::MessageBase::MessageBase(size_t size, uint32_t messageType)
 {
 	_prefix = '\x7e';
 	_length = size - 2;
-	_messageType = messageType & 0x00ffffff;
+	WireBytes<3>::Write(_id, messageType);
 }
 
 
@@ -18,21 +19,10 @@ void BalBoa::MessageBase::Dump() const
 
 void BalBoa::MessageBase::Dump(size_t size) const
 {
-	byte *pStart = (byte *)this;
-
-	Serial.print(F("Dump - # bytes: "));
-	Serial.println(size);
-
-	for (size_t i = 0; i < size; i++)
+	if (LogOutput)
 	{
-		if (pStart[i] < 0x10)
-		{
-			Serial.print('0');
-		}
-		Serial.print(pStart[i], HEX), Serial.print(' ');
+		DumpHex(*LogOutput, (const byte *)this, size);
 	}
-
-	if (size > 0) Serial.println();
 }
 
 void 
@@ -55,6 +45,23 @@ BalBoa::MessageBase::CalcCRC() const
 }
 
 
+bool
+BalBoa::MessageBase::IsUserCommand() const
+{
+	switch (Id())
+	{
+	case msToggleItemRequest:
+	case msSetTempRequest:
+	case msSetTempScaleRequest:
+	case msSetTimeRequest:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
 
 BalBoa::MessageSuffix::MessageSuffix()
 {
@@ -70,25 +77,23 @@ BalBoa::ConfigRequest::ConfigRequest()
 
 BalBoa::FilterConfigRequest::FilterConfigRequest()
 	: MessageBaseOutgoing(sizeof(*this), msFilterConfigRequest),
-	_payload{0x01, 0x00, 0x00}
+	_payload{}
 {
+	SettingsRequestPayload::Kind::Set(_payload, 0x01);
 }
 
 BalBoa::ControlConfigRequest::ControlConfigRequest(
 	bool isType1)
-	: MessageBaseOutgoing(sizeof(*this), msControlConfigRequest)
+	: MessageBaseOutgoing(sizeof(*this), msControlConfigRequest),
+	_payload{}
 {
 	if (isType1)
 	{
-		_payload[0] = 0x02;
-		_payload[1] = 0x00;
-		_payload[2] = 0x00;
+		SettingsRequestPayload::Kind::Set(_payload, 0x02);
 	}
 	else
 	{
-		_payload[0] = 0x00;
-		_payload[1] = 0x00;
-		_payload[2] = 0x01;
+		SettingsRequestPayload::R2::Set(_payload, 0x01);
 	}
 }
 
@@ -96,25 +101,137 @@ BalBoa::ControlConfigRequest::ControlConfigRequest(
 BalBoa::SetSpaTime::SetSpaTime(
 	const BalBoa::SpaTime &time)
 	: MessageBaseOutgoing(sizeof(*this), msSetTimeRequest),
-	_hour(time.hour), _displayAs24Hr(time.displayAs24Hr), _minute(time.minute)
-{}
+	_payload{}
+{
+	SetTimePayload::Hour::Set(_payload, time.hour);
+	SetTimePayload::DisplayAs24Hr::Set(_payload, time.displayAs24Hr);
+	SetTimePayload::Minute::Set(_payload, time.minute);
+}
 
 BalBoa::ToggleItemMessage::ToggleItemMessage(
 	ToggleItem item)
 	: MessageBaseOutgoing(sizeof(*this), msToggleItemRequest),
-	_item(item), _r(0)
-{}
+	_payload{}
+{
+	ToggleItemPayload::Item::Set(_payload, item);
+}
 
 
 BalBoa::SetSpaTempMessage::SetSpaTempMessage(
 	const BalBoa::SpaTemp &temp)
 	: MessageBaseOutgoing(sizeof(*this), msSetTempRequest),
-	_temp(temp.temp)
-{}
+	_payload{}
+{
+	SetTempPayload::Temp::Set(_payload, temp.temp);
+}
 
 
 BalBoa::SetSpaTempScaleMessage::SetSpaTempScaleMessage(
 	bool scaleCelsius)
 	: MessageBaseOutgoing(sizeof(*this), msSetTempScaleRequest),
-	_scale(scaleCelsius)
-{}
\ No newline at end of file
+	_payload{}
+{
+	SetTempScalePayload::R1::Set(_payload, 0x01);
+	SetTempScalePayload::Scale::Set(_payload, scaleCelsius);
+}
+
+
+//  Whole frames, nothing added by the compiler.
+#define BALBOA_CHECK_SIZE(message, payload)                                      \
+	static_assert(sizeof(BalBoa::message) == sizeof(BalBoa::MessageBase)         \
+				  + BalBoa::payload::length + sizeof(BalBoa::MessageSuffix),     \
+				  #message " isn't the size of its payload");
+
+BALBOA_CHECK_SIZE(ConfigRequest, ConfigRequestPayload)
+BALBOA_CHECK_SIZE(FilterConfigRequest, SettingsRequestPayload)
+BALBOA_CHECK_SIZE(ControlConfigRequest, SettingsRequestPayload)
+BALBOA_CHECK_SIZE(SetSpaTime, SetTimePayload)
+BALBOA_CHECK_SIZE(ToggleItemMessage, ToggleItemPayload)
+BALBOA_CHECK_SIZE(SetSpaTempMessage, SetTempPayload)
+BALBOA_CHECK_SIZE(SetSpaTempScaleMessage, SetTempScalePayload)
+
+#undef BALBOA_CHECK_SIZE
+
+
+namespace
+{
+	void DumpArray(Print &output, const byte *pBytes, byte count)
+	{
+		for (byte i = 0; i < count; i++)
+		{
+			if (pBytes[i] < 0x10)
+			{
+				output.print('0');
+			}
+			output.print(pBytes[i], HEX);
+			output.print(' ');
+		}
+		output.println();
+	}
+}
+
+
+#define BALBOA_DUMP_FIELD(name, offset, shift, bits)                             \
+	output.print(F("  " #name ": "));                                            \
+	output.println((unsigned long)Payload::name::Get(pPayload));
+
+#define BALBOA_DUMP_ARRAY(name, offset, count)                                   \
+	output.print(F("  " #name ": "));                                            \
+	DumpArray(output, Payload::name::Get(pPayload), count);
+
+#define BALBOA_DEFINE_DUMP(payload, fields)                                      \
+	void                                                                         \
+	BalBoa::payload::Dump(Print &output, const byte *pPayload)                   \
+	{                                                                            \
+		typedef BalBoa::payload Payload;                                         \
+		fields(BALBOA_DUMP_FIELD, BALBOA_DUMP_ARRAY)                             \
+		(void)output, (void)pPayload, (void)sizeof(Payload);                     \
+	}
+
+BALBOA_DEFINE_DUMP(StatusPayload, BALBOA_STATUS_FIELDS)
+BALBOA_DEFINE_DUMP(ConfigResponsePayload, BALBOA_CONFIG_RESPONSE_FIELDS)
+BALBOA_DEFINE_DUMP(FilterConfigPayload, BALBOA_FILTER_CONFIG_FIELDS)
+BALBOA_DEFINE_DUMP(ControlConfigPayload, BALBOA_CONTROL_CONFIG_FIELDS)
+BALBOA_DEFINE_DUMP(ControlConfig2Payload, BALBOA_CONTROL_CONFIG2_FIELDS)
+BALBOA_DEFINE_DUMP(SetTempRangePayload, BALBOA_SET_TEMP_RANGE_FIELDS)
+BALBOA_DEFINE_DUMP(ConfigRequestPayload, BALBOA_CONFIG_REQUEST_FIELDS)
+BALBOA_DEFINE_DUMP(SettingsRequestPayload, BALBOA_SETTINGS_REQUEST_FIELDS)
+BALBOA_DEFINE_DUMP(SetTimePayload, BALBOA_SET_TIME_FIELDS)
+BALBOA_DEFINE_DUMP(ToggleItemPayload, BALBOA_TOGGLE_ITEM_FIELDS)
+BALBOA_DEFINE_DUMP(SetTempPayload, BALBOA_SET_TEMP_FIELDS)
+BALBOA_DEFINE_DUMP(SetTempScalePayload, BALBOA_SET_TEMP_SCALE_FIELDS)
+
+#undef BALBOA_DEFINE_DUMP
+#undef BALBOA_DUMP_ARRAY
+#undef BALBOA_DUMP_FIELD
+
+
+void
+BalBoa::MessageBase::DumpFields(Print &output, bool fromSpa) const
+{
+	const uint32_t id = Id();
+
+#define BALBOA_DUMP_MESSAGE(name, messageId, ...)                                \
+	if (id == messageId)                                                         \
+	{                                                                            \
+		output.println(F(#name));                                                \
+		if (PayloadLength() >= name##Payload::length)                            \
+		{                                                                        \
+			name##Payload::Dump(output, Payload());                              \
+		}                                                                        \
+		return;                                                                  \
+	}
+
+	if (fromSpa)
+	{
+		BALBOA_SPA_MESSAGES(BALBOA_DUMP_MESSAGE)
+	}
+	else
+	{
+		BALBOA_COMMAND_MESSAGES(BALBOA_DUMP_MESSAGE)
+	}
+
+#undef BALBOA_DUMP_MESSAGE
+
+	DumpHex(output, reinterpret_cast<const byte *>(this), _length + 2);
+}
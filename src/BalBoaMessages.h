@@ -39,6 +39,274 @@ namespace BalBoa
 		msSetFilterConfigRequest = MESSAGE_ID(0x0a, 0xbf, 0x23)  // Not implemented
 	};
 
+	//  Fields of a message, described by where they are rather than declared as bitfields,
+	//  whose layout is up to the compiler.  Values are read and written a byte at a time,
+	//  shifted and masked, so they come out the same on every platform and never need an
+	//  aligned address.  'offset' is the payload byte number, 'shift' the bit number the
+	//  field starts at.  Fields wider than a byte are little endian.
+	template <byte bytes>
+	struct WireBytes
+	{
+		typedef uint32_t Type;
+
+		static Type Read(const byte *p)
+		{
+			return p[0] | ((Type)WireBytes<bytes - 1>::Read(p + 1) << 8);
+		};
+		static void Write(byte *p, Type value)
+		{
+			p[0] = (byte)value;
+			WireBytes<bytes - 1>::Write(p + 1, value >> 8);
+		};
+	};
+
+	template <>
+	struct WireBytes<1>
+	{
+		typedef byte Type;
+
+		static Type Read(const byte *p)
+		{
+			return p[0];
+		};
+		static void Write(byte *p, Type value)
+		{
+			p[0] = value;
+		};
+	};
+
+	template <>
+	struct WireBytes<2>
+	{
+		typedef uint16_t Type;
+
+		static Type Read(const byte *p)
+		{
+			return p[0] | ((Type)p[1] << 8);
+		};
+		static void Write(byte *p, Type value)
+		{
+			p[0] = (byte)value;
+			p[1] = (byte)(value >> 8);
+		};
+	};
+
+	template <byte Offset, byte Shift, byte Bits>
+	struct WireField
+	{
+		static_assert((Bits > 0) && (Shift < 8) && (Shift + Bits <= 32), "Field doesn't fit");
+
+		static constexpr byte offset = Offset;
+		static constexpr byte shift = Shift;
+		static constexpr byte bytes = (Shift + Bits + 7) / 8;
+		static constexpr byte end = Offset + bytes;
+
+		typedef typename WireBytes<bytes>::Type Type;
+
+		//  Bits of the field, before shifting.
+		static constexpr Type mask = (Type)(((uint32_t)2 << (Bits - 1)) - 1);
+
+		static Type Get(const byte *pPayload)
+		{
+			return (Type)(WireBytes<bytes>::Read(pPayload + Offset) >> Shift) & mask;
+		};
+
+		//  Leaves the other bits of the byte(s) alone.
+		static void Set(byte *pPayload, uint32_t value)
+		{
+			const Type field = (Type)(mask << Shift);
+			const Type old = WireBytes<bytes>::Read(pPayload + Offset);
+
+			WireBytes<bytes>::Write(pPayload + Offset,
+									(Type)((old & ~field) | ((value << Shift) & field)));
+		};
+	};
+
+	//  A run of bytes, left as they are.
+	template <byte Offset, byte Length>
+	struct WireArray
+	{
+		static constexpr byte offset = Offset;
+		static constexpr byte length = Length;
+		static constexpr byte end = Offset + Length;
+
+		static const byte *Get(const byte *pPayload)
+		{
+			return pPayload + Offset;
+		};
+
+		static void Set(byte *pPayload, const byte *pValue)
+		{
+			memcpy(pPayload + Offset, pValue, Length);
+		};
+	};
+
+#define BALBOA_WIRE_FIELD(name, offset, shift, bits)                             \
+		typedef WireField<offset, shift, bits> name;                             \
+		static_assert(name::end <= length, #name " is past the end of the payload");
+
+#define BALBOA_WIRE_ARRAY(name, offset, count)                                   \
+		typedef WireArray<offset, count> name;                                   \
+		static_assert(name::end <= length, #name " is past the end of the payload");
+
+	//  A payload's fields, and Dump() to print them one per line.
+#define BALBOA_PAYLOAD(payload, size, fields)                                    \
+	struct payload                                                               \
+	{                                                                            \
+		static constexpr byte length = size;                                     \
+		fields(BALBOA_WIRE_FIELD, BALBOA_WIRE_ARRAY)                             \
+		static void Dump(Print &, const byte *pPayload);                         \
+	};
+
+
+	//  Following payloads are only received.
+	//
+	//  Everything that's decoded is listed, as FIELD(name, byte, first bit, bits) or
+	//  BYTES(name, first byte, count).  Anything not listed isn't understood yet, see
+	//  BalBoaAnalyzer.h.
+
+#define BALBOA_STATUS_FIELDS(FIELD, BYTES)                                       \
+	FIELD(Priming,           1, 0, 1)                                            \
+	FIELD(CurrentTemp,       2, 0, 8)                                            \
+	FIELD(Hour,              3, 0, 8)                                            \
+	FIELD(Minute,            4, 0, 8)                                            \
+	FIELD(HeatingMode,       5, 0, 2)                                            \
+	FIELD(PanelMessage,      6, 0, 4)                                            \
+	FIELD(HoldTime,          8, 0, 8)   /* If SystemHold */                      \
+	FIELD(TempScaleCelsius,  9, 0, 1)                                            \
+	FIELD(Display24Hr,       9, 1, 1)                                            \
+	FIELD(Filter1Running,    9, 2, 1)                                            \
+	FIELD(Filter2Running,    9, 3, 1)                                            \
+	FIELD(TempRange,        10, 2, 1)                                            \
+	FIELD(Heating,          10, 4, 2)                                            \
+	FIELD(Pump1,            11, 0, 2)                                            \
+	FIELD(Pump2,            11, 2, 2)                                            \
+	FIELD(CircPump,         13, 1, 1)                                            \
+	FIELD(Light,            14, 0, 2)                                            \
+	FIELD(TimeUnset,        18, 1, 1)   /* 18 & 19 bit 2 seem related to this */ \
+	FIELD(SetTemp,          20, 0, 8)                                            \
+	FIELD(SystemHold,       21, 2, 1)
+
+	BALBOA_PAYLOAD(StatusPayload, 24, BALBOA_STATUS_FIELDS)
+
+	//  Unknown structure.
+#define BALBOA_CONFIG_RESPONSE_FIELDS(FIELD, BYTES)
+
+	BALBOA_PAYLOAD(ConfigResponsePayload, 25, BALBOA_CONFIG_RESPONSE_FIELDS)
+
+#define BALBOA_FILTER_CONFIG_FIELDS(FIELD, BYTES)                                \
+	FIELD(Filter1StartHour,        0, 0, 8)                                      \
+	FIELD(Filter1StartMinute,      1, 0, 8)                                      \
+	FIELD(Filter1DurationHours,    2, 0, 8)                                      \
+	FIELD(Filter1DurationMinutes,  3, 0, 8)                                      \
+	FIELD(Filter2StartHour,        4, 0, 7)                                      \
+	FIELD(Filter2Enabled,          4, 7, 1)                                      \
+	FIELD(Filter2StartMinute,      5, 0, 8)                                      \
+	FIELD(Filter2DurationHours,    6, 0, 8)                                      \
+	FIELD(Filter2DurationMinutes,  7, 0, 8)
+
+	BALBOA_PAYLOAD(FilterConfigPayload, 8, BALBOA_FILTER_CONFIG_FIELDS)
+
+	//  It's really version info.
+#define BALBOA_CONTROL_CONFIG_FIELDS(FIELD, BYTES)                               \
+	BYTES(Version,                 0, 3)                                         \
+	BYTES(Name,                    4, 8)                                         \
+	FIELD(CurrentSetup,           12, 0, 8)                                      \
+	FIELD(Signature,              13, 0, 32)
+
+	BALBOA_PAYLOAD(ControlConfigPayload, 21, BALBOA_CONTROL_CONFIG_FIELDS)
+
+#define BALBOA_CONTROL_CONFIG2_FIELDS(FIELD, BYTES)
+
+	BALBOA_PAYLOAD(ControlConfig2Payload, 6, BALBOA_CONTROL_CONFIG2_FIELDS)
+
+	//  Not looked at, any length will do.
+#define BALBOA_SET_TEMP_RANGE_FIELDS(FIELD, BYTES)
+
+	BALBOA_PAYLOAD(SetTempRangePayload, 0, BALBOA_SET_TEMP_RANGE_FIELDS)
+
+
+	//  Following payloads are only sent.
+
+#define BALBOA_CONFIG_REQUEST_FIELDS(FIELD, BYTES)
+
+	BALBOA_PAYLOAD(ConfigRequestPayload, 0, BALBOA_CONFIG_REQUEST_FIELDS)
+
+	//  Filter times (01 00 00), version info (02 00 00) or control config (00 00 01).
+#define BALBOA_SETTINGS_REQUEST_FIELDS(FIELD, BYTES)                             \
+	FIELD(Kind,                    0, 0, 8)                                      \
+	FIELD(R1,                      1, 0, 8)                                      \
+	FIELD(R2,                      2, 0, 8)
+
+	BALBOA_PAYLOAD(SettingsRequestPayload, 3, BALBOA_SETTINGS_REQUEST_FIELDS)
+
+#define BALBOA_SET_TIME_FIELDS(FIELD, BYTES)                                     \
+	FIELD(Hour,                    0, 0, 7)                                      \
+	FIELD(DisplayAs24Hr,           0, 7, 1)                                      \
+	FIELD(Minute,                  1, 0, 8)
+
+	BALBOA_PAYLOAD(SetTimePayload, 2, BALBOA_SET_TIME_FIELDS)
+
+#define BALBOA_TOGGLE_ITEM_FIELDS(FIELD, BYTES)                                  \
+	FIELD(Item,                    0, 0, 8)                                      \
+	FIELD(R,                       1, 0, 8)
+
+	BALBOA_PAYLOAD(ToggleItemPayload, 2, BALBOA_TOGGLE_ITEM_FIELDS)
+
+#define BALBOA_SET_TEMP_FIELDS(FIELD, BYTES)                                     \
+	FIELD(Temp,                    0, 0, 8)
+
+	BALBOA_PAYLOAD(SetTempPayload, 1, BALBOA_SET_TEMP_FIELDS)
+
+#define BALBOA_SET_TEMP_SCALE_FIELDS(FIELD, BYTES)                               \
+	FIELD(R1,                      0, 0, 8)   /* Always 1 */                     \
+	FIELD(Scale,                   1, 0, 8)
+
+	BALBOA_PAYLOAD(SetTempScalePayload, 2, BALBOA_SET_TEMP_SCALE_FIELDS)
+
+
+	//  Every message the spa sends, with its payload (name##Payload) and the SpaProtocol
+	//  member that handles it.  The order gives each a small index, for table lookups.
+#define BALBOA_SPA_MESSAGES(X)                                                   \
+	X(Status,          msStatus,           StatusArrived)                        \
+	X(ConfigResponse,  msConfigResponse,   CrackConfigMessage)                   \
+	X(FilterConfig,    msFilterConfig,     CrackFilterMessage)                   \
+	X(ControlConfig,   msControlConfig,    CrackVersionMessage)                  \
+	X(ControlConfig2,  msControlConfig2,   IgnoreMessage)                        \
+	X(SetTempRange,    msSetTempRange,     IgnoreMessage)
+
+	//  And every message sent to it.  msControlConfigRequest is msFilterConfigRequest.
+#define BALBOA_COMMAND_MESSAGES(X)                                               \
+	X(ConfigRequest,   msConfigRequest)                                          \
+	X(SettingsRequest, msFilterConfigRequest)                                    \
+	X(ToggleItem,      msToggleItemRequest)                                      \
+	X(SetTemp,         msSetTempRequest)                                         \
+	X(SetTempScale,    msSetTempScaleRequest)                                    \
+	X(SetTime,         msSetTimeRequest)
+
+	enum SpaMessageIndex : byte
+	{
+#define BALBOA_MESSAGE_INDEX(name, id, handler) mi##name,
+		BALBOA_SPA_MESSAGES(BALBOA_MESSAGE_INDEX)
+#undef BALBOA_MESSAGE_INDEX
+		miCOUNT
+	};
+
+	//  Index of a message from the spa, miCOUNT if it isn't one.
+	inline SpaMessageIndex SpaMessage(uint32_t id)
+	{
+#define BALBOA_MESSAGE_MATCH(name, messageId, handler)                           \
+		if (id == messageId)                                                     \
+		{                                                                        \
+			return mi##name;                                                     \
+		}
+		BALBOA_SPA_MESSAGES(BALBOA_MESSAGE_MATCH)
+#undef BALBOA_MESSAGE_MATCH
+
+		return miCOUNT;
+	}
+
+
 	//  Each message consists of a payload and 7 bytes overhead.  At the beginning of each
 	//  message is a prefix (always 0x7e), then length of the message *without the prefix
 	//  or suffix*, and a three byte message ID.
@@ -46,7 +314,25 @@ namespace BalBoa
 	{
 		byte _prefix;
 		byte _length;
-		uint32_t _messageType : 24;
+		byte _id[3];
+
+		uint32_t Id() const
+		{
+			return WireBytes<3>::Read(_id);
+		};
+
+		const byte *Payload() const
+		{
+			return reinterpret_cast<const byte *>(this) + sizeof(MessageBase);
+		};
+		byte *Payload()
+		{
+			return reinterpret_cast<byte *>(this) + sizeof(MessageBase);
+		};
+		byte PayloadLength() const
+		{
+			return _length - 5;
+		};
 
 		void Dump() const;
 		void Dump(size_t) const;
@@ -54,10 +340,16 @@ namespace BalBoa
 		bool CheckCRC() const;
 		byte CalcCRC() const;
 
+		//  Field by field, as the message from the spa ('fromSpa') or the command it is.
+		void DumpFields(Print &, bool fromSpa) const;
+
+		//  Something the user asked for, as opposed to a request for information.
+		bool IsUserCommand() const;
+
 	protected:
-		MessageBase(size_t, unsigned long);
+		MessageBase(size_t, uint32_t);
 		MessageBase() = default;
-	} __attribute__((packed));
+	};
 
 	//  The last two bytes of overhead are a check byte (8 bit CRC), and a suffix (also
 	//  always 0x7e).
@@ -67,15 +359,14 @@ namespace BalBoa
 		byte _suffix;
 
 		MessageSuffix();
-	} __attribute__((packed));
+	};
+
+	static_assert((sizeof(MessageBase) == 5) && (sizeof(MessageSuffix) == 2),
+				  "Message framing must be bytes only");
 
 
 	//  Some type safety, make sure the right message ID's are applied to the right
 	//  messages.
-	struct MessageBaseIncoming : public MessageBase
-	{
-	};
-
 	struct MessageBaseOutgoing : public MessageBase
 	{
 	protected:
@@ -85,142 +376,41 @@ namespace BalBoa
 	};
 
 
-
-	//  Following messages are only received.  They are never instantiated, hence no
-	//  constructor.  
-	//
-	//  Using bitfields, we can read the message directly from memory without any
-	//  bit-twiddling.
-	//
-	//  As needed, unknown areas are marked as '_r*'.  Note that some bitfields are
-	//  skipped rather than marked.
-
-	struct ConfigResponseMessage : public MessageBaseIncoming
-	{
-		byte _r[25];    //  Unknown structure
-		MessageSuffix _suffix;
-	} __attribute__((packed));
-
-	struct StatusMessage : public MessageBaseIncoming
-	{                               // byte #
-		byte _r1;                   // 00
-		byte _priming : 1;          // 01
-		byte : 0;                   //
-		byte _currentTemp;          // 02
-		byte _hour;                 // 03
-		byte _minute;               // 04
-		byte _heatingMode : 2;      // 05
-		byte : 0;                   // 
-		byte _panelMessage : 4;     // 06
-		byte : 0;                   //
-		byte _r2;                   // 07, 
-		byte _holdTime;             // 08  if _systemHold is true
-		byte _tempScaleCelsius : 1; // 09
-		byte _24hrTime : 1;         //
-		byte _filter1Running : 1;   // 
-		byte _filter2Running : 1;   //
-		byte : 0;                   //
-		byte _r3 : 2;               // 10
-		byte _tempRange : 1;        //
-		byte _r4 : 1;               //
-		byte _heating : 2;          //
-		byte : 0;                   //
-		byte _pump1 : 2;            // 11
-		byte _pump2 : 2;            //
-		byte : 0;                   //
-		byte _r5;                   // 12
-		byte _r6 : 1;               // 13
-		byte _circPump : 1;         //
-		byte : 0;                   //
-		byte _light : 2;            // 14
-		byte : 0;                   //
-		byte _r7[3];                // 15->17
-		byte _r7a : 1;              // both 18 & 19, bit 2 seem related to time not
-		byte _timeUnset : 1;        // yet set.
-		byte : 0;
-		byte _r7b;                  // 19
-		byte _setTemp;              // 20
-		byte _r8 : 2;               // 21
-		byte _systemHold : 1;
-		byte : 0;
-		byte _r9[2];                // 22, 23
-
-		MessageSuffix _suffix;      
-
-	} __attribute__((packed));
-
-	struct FilterStatusMessage :public MessageBaseIncoming
-	{                                // byte
-		byte filter1StartHour;       // 00
-		byte filter1StartMinute;     // 01
-		byte filter1DurationHours;   // 02
-		byte filter1DurationMinutes; // 03
-		byte filter2StartHour : 7;   // 04
-		byte filter2enabled : 1;     //
-		byte filter2StartMinute;     // 05
-		byte filter2DurationHours;   // 06
-		byte filter2DurationMinutes; // 07
-
-		MessageSuffix _suffix;       
-	} __attribute__((packed));
-
-
-	struct ControlConfigResponse : public MessageBaseIncoming
-	{                        // byte
-		byte _version[3];    // 00, 01, 02
-		byte _r1;            // 03
-		byte _name[8];       // 04->11
-		byte _currentSetup;  // 12
-		uint32_t _signature; // 13->16
-		byte _r2[4];         // 17->20
-
-		MessageSuffix _sufffix;
-	} __attribute__((packed));
-
-
-	struct ControlConfig2Response : public MessageBaseIncoming
-	{
-		byte _r1[6];
-
-		MessageSuffix _suffix;
-	};
-
-	//  Following messages are only sent.  Once contructed, they are ready to go.
+	//  Following messages are only sent.  Once contructed, they are ready to go.  The
+	//  payload is written through the fields above.
 	struct ConfigRequest : public BalBoa::MessageBaseOutgoing
 	{
 		ConfigRequest();
 		//  No content
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 	struct FilterConfigRequest : public BalBoa::MessageBaseOutgoing
 	{
 		FilterConfigRequest();
 
-		byte _payload[3];
+		byte _payload[SettingsRequestPayload::length];
 
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 	struct ControlConfigRequest : public MessageBaseOutgoing
 	{
 		ControlConfigRequest(bool type1);
 
-		byte _payload[3];
+		byte _payload[SettingsRequestPayload::length];
 
 		MessageSuffix _suffix;
-	}  __attribute__((packed));
+	};
 
 	struct SetSpaTime : public MessageBaseOutgoing
 	{
 		SetSpaTime(const BalBoa::SpaTime &);
 
-		byte _hour : 7;
-		byte _displayAs24Hr : 1;
-		byte _minute;
+		byte _payload[SetTimePayload::length];
 
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 
 	enum ToggleItem
@@ -235,30 +425,28 @@ namespace BalBoa
 	{
 		ToggleItemMessage(ToggleItem Item);
 
-		byte _item;
-		byte _r;
+		byte _payload[ToggleItemPayload::length];
 
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 	struct SetSpaTempMessage : public MessageBaseOutgoing
 	{
 		SetSpaTempMessage(const BalBoa::SpaTemp &);
 
-		byte _temp;
+		byte _payload[SetTempPayload::length];
 
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 	struct SetSpaTempScaleMessage : public MessageBaseOutgoing
 	{
 		SetSpaTempScaleMessage(bool scaleCelsius);
 
-		byte _r1 = 0x01;
-		byte _scale;
+		byte _payload[SetTempScalePayload::length];
 
 		MessageSuffix _suffix;
-	} __attribute__((packed));
+	};
 
 }
 #endif
@@ -0,0 +1,71 @@
+//  Everything platform specific about talking to the spa: the TCP client and UDP classes
+//  (SpaClient, SpaUdp), and where millis(), Print and friends come from.  The protocol
+//  code is the same everywhere, only this changes.
+//
+//  To add a new board, add a section defining SpaClient and SpaUdp here, and a matching
+//  'Networking' object in BalBoaSpa.cpp.
+//
+//  Where SpaClient can connect without blocking (connectStart() / connectPoll()), the
+//  section also defines BALBOA_ASYNC_CONNECT:  Linux and ESP32, which both have BSD
+//  sockets.  Elsewhere connect() blocks loop(), so it's given no more than
+//  BALBOA_BLOCKING_CONNECT_TIMEOUT ms; add the board to ConnectClient() in BalBoaSpa.cpp.
+//  That's AVR, and ESP8266, whose core uses lwIP's raw API with no socket layer to build
+//  a non-blocking connect on.
+
+#ifndef _BALBOAPLATFORM_h
+#define _BALBOAPLATFORM_h
+
+#if defined ARDUINO
+
+#include <Arduino.h>
+
+#if defined ARDUINO_ARCH_ESP8266
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+typedef WiFiClient SpaClient;
+typedef WiFiUDP SpaUdp;
+#define BALBOA_HAVE_NETWORK 1
+
+#elif defined ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#include "BalBoaEsp32.h"
+
+typedef BalBoa::Esp32Client SpaClient;
+typedef WiFiUDP SpaUdp;
+#define BALBOA_HAVE_NETWORK 1
+#define BALBOA_ASYNC_CONNECT 1
+
+#elif defined ARDUINO_ARCH_AVR
+#include <Ethernet.h>
+
+typedef EthernetClient SpaClient;
+typedef EthernetUDP SpaUdp;
+#define BALBOA_HAVE_NETWORK 1
+
+#endif
+
+#elif defined __unix__
+
+//  Linux (or other POSIX) host build, see BalBoaHost.h
+#include "BalBoaHost.h"
+
+typedef BalBoa::PosixClient SpaClient;
+typedef BalBoa::PosixUdp SpaUdp;
+#define BALBOA_HAVE_NETWORK 1
+#define BALBOA_ASYNC_CONNECT 1
+
+#else
+#error "Unknown platform, see BalBoaPlatform.h"
+#endif
+
+#if !defined BALBOA_ASYNC_CONNECT
+#define BALBOA_ASYNC_CONNECT 0
+#endif
+
+//  A spa on the local network answers in a few ms.
+#if !defined BALBOA_BLOCKING_CONNECT_TIMEOUT
+#define BALBOA_BLOCKING_CONNECT_TIMEOUT 250
+#endif
+
+#endif
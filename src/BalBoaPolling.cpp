@@ -0,0 +1,135 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaPolling.h"
+
+namespace
+{
+	unsigned long Average(unsigned long average, unsigned long sample)
+	{
+		return average ? (average * 7 + sample + 4) / 8 : sample;
+	}
+}
+
+
+BalBoa::PollScheduler::PollScheduler()
+{
+	Reset(0);
+}
+
+
+void
+BalBoa::PollScheduler::Reset(unsigned long now)
+{
+	_interval = BALBOA_POLL_MIN;
+	_lastPoll = now;
+	_commandTime = 0;
+	_commandSent = false;
+	_active = false;
+	_changed = false;
+	_holding = false;
+	_handshakeUs = 0;
+	_frameUs = 0;
+	_frameGap = 1000;   //  What spas send, until measured
+}
+
+
+void
+BalBoa::PollScheduler::Observe(unsigned int changes, bool active, unsigned long now)
+{
+	if (changes & ~scTime)
+	{
+		_interval = BALBOA_POLL_MIN;
+		_changed = true;
+	}
+
+	_active = active;
+
+	if (_holding && ((now - _lastPoll) >= Interval(now)))
+	{
+		Polled(now);
+	}
+	else
+	{
+		UpdateHold(now);
+	}
+}
+
+
+void
+BalBoa::PollScheduler::CommandSent(unsigned long now)
+{
+	_commandTime = now;
+	_commandSent = true;
+}
+
+
+void
+BalBoa::PollScheduler::Polled(unsigned long now)
+{
+	if (!_changed)
+	{
+		_interval = min(_interval * 2, (unsigned long)BALBOA_POLL_MAX);
+	}
+
+	_changed = false;
+	_lastPoll = now;
+
+	UpdateHold(now);
+}
+
+
+void
+BalBoa::PollScheduler::HandshakeCost(unsigned long us)
+{
+	_handshakeUs = Average(_handshakeUs, max(us, 1UL));
+}
+
+
+void
+BalBoa::PollScheduler::FramesCost(unsigned long us, unsigned long frames, unsigned long ms)
+{
+	if (frames == 0)
+	{
+		return;
+	}
+
+	_frameUs = Average(_frameUs, max((us + frames / 2) / frames, 1UL));
+
+	//  A poll is over as soon as the status arrives, so only longer stretches say how
+	//  often the spa sends.
+	if (frames >= 5)
+	{
+		_frameGap = Average(_frameGap, max(ms / frames, 1UL));
+	}
+}
+
+
+unsigned long
+BalBoa::PollScheduler::Interval(unsigned long now) const
+{
+	if (_active || (_commandSent && ((now - _commandTime) < BALBOA_POLL_COMMAND_HOLD)))
+	{
+		return min(_interval, (unsigned long)BALBOA_POLL_ACTIVE);
+	}
+
+	return _interval;
+}
+
+
+void
+BalBoa::PollScheduler::UpdateHold(unsigned long now)
+{
+	if (!_handshakeUs || !_frameUs)
+	{
+		//  Nothing to go on yet.
+		_holding = false;
+		return;
+	}
+
+	const unsigned long held = (Interval(now) / _frameGap) * _frameUs;
+	const unsigned long poll = _handshakeUs + _frameUs;
+
+	//  A little hysteresis, so it doesn't flip on every measurement.
+	_holding = _holding ? (held <= poll + poll / 4) : (held < poll);
+}
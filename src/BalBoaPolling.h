@@ -0,0 +1,105 @@
+//  Picks how often to poll the spa, and whether to stay connected, from what it's doing.
+//
+//  Pass ADAPTIVE_POLLING to BalBoaSpa::begin() (or setPollingInterval()) in place of a
+//  fixed interval.  While the heater, a pump or priming is on, and for
+//  BALBOA_POLL_COMMAND_HOLD ms after a command, the spa is polled every
+//  BALBOA_POLL_ACTIVE ms.  Otherwise polling starts at BALBOA_POLL_MIN, and each poll
+//  that finds nothing changed (the clock aside) doubles the interval, up to
+//  BALBOA_POLL_MAX.  Any change goes back to BALBOA_POLL_MIN.
+//
+//  Staying connected costs processing every status message the spa sends (about one a
+//  second); polling costs a TCP connect and disconnect each time.  Both are measured, in
+//  micro-seconds of loop() time, and the connection is held while the messages over one
+//  interval would cost less than a reconnect.  Where connect() blocks that's nearly
+//  always; on Linux it depends on the interval.
+
+#ifndef _BALBOAPOLLING_h
+#define _BALBOAPOLLING_h
+
+#if !defined BALBOA_POLL_ACTIVE
+#define BALBOA_POLL_ACTIVE 10000
+#endif
+
+#if !defined BALBOA_POLL_MIN
+#define BALBOA_POLL_MIN 30000
+#endif
+
+#if !defined BALBOA_POLL_MAX
+#define BALBOA_POLL_MAX 900000
+#endif
+
+#if !defined BALBOA_POLL_COMMAND_HOLD
+#define BALBOA_POLL_COMMAND_HOLD 120000
+#endif
+
+namespace BalBoa
+{
+	//  Polling interval meaning 'let PollScheduler decide'.
+	constexpr unsigned long ADAPTIVE_POLLING = 0xFFFFFFFF;
+
+	class PollScheduler
+	{
+	public:
+		PollScheduler();
+
+		//  Back to BALBOA_POLL_MIN, forgetting what's been measured.
+		void Reset(unsigned long now);
+
+		//  Call as messages arrive, with the changes since last time (scTime is ignored)
+		//  and whether the heater, a pump or priming is on.  While the connection is held
+		//  this also counts off the intervals, as Polled() would.
+		void Observe(unsigned int changes, bool active, unsigned long now);
+
+		void CommandSent(unsigned long now);
+
+		//  A poll is done, and the connection closed.
+		void Polled(unsigned long now);
+
+		//  Measured loop() time:  to connect and later disconnect, and to take in 'frames'
+		//  status messages over 'ms' milli-seconds connected.
+		void HandshakeCost(unsigned long us);
+		void FramesCost(unsigned long us, unsigned long frames, unsigned long ms);
+
+		//  How long to wait between polls right now.
+		unsigned long Interval(unsigned long now) const;
+
+		//  Ignoring activity and commands.
+		unsigned long IdleInterval() const
+		{
+			return _interval;
+		};
+
+		bool HoldConnection() const
+		{
+			return _holding;
+		};
+
+		//  Averages so far, 0 until measured.
+		unsigned long HandshakeUs() const
+		{
+			return _handshakeUs;
+		};
+		unsigned long FrameUs() const
+		{
+			return _frameUs;
+		};
+
+	private:
+		void UpdateHold(unsigned long now);
+
+		unsigned long _interval;
+		unsigned long _lastPoll;
+		unsigned long _commandTime;
+		bool _commandSent;
+		bool _active;
+		bool _changed;   //  Since the last poll
+		bool _holding;
+
+		//  Moving averages, 1/8 new.
+		unsigned long _handshakeUs;
+		unsigned long _frameUs;
+		unsigned long _frameGap;   //  Milli-seconds between status messages
+	};
+}
+
+#endif
@@ -0,0 +1,1439 @@
+
+#include "BalBoaPlatform.h"
+#include "crc.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaLog.h"
+
+
+BalBoa::SpaProtocol::SpaProtocol()
+	: _waitingForMessages(0), _changes(scNONE), _sceneStatus(csNone), _sceneRounds(0),
+	  _scenePlanned(0), _stateUpdates(0), _generations(), _callbacks(), _handledChanges(0)
+{
+	_time.hour = UNKNOWN_VAL;
+	ResetState();
+}
+
+
+byte *
+BalBoa::SpaProtocol::ReceiveBuffer(size_t &space)
+{
+	return _decoder.ReceiveBuffer(space);
+}
+
+
+void
+BalBoa::SpaProtocol::Received(size_t count)
+{
+	_decoder.Received(count);
+
+	//  Only frames that pass the length, check byte and terminator tests come back from
+	//  the decoder.  A trailing partial frame stays buffered.
+	while (const MessageBase *pMessageBase = _decoder.NextFrame())
+	{
+		ProcessMessage(pMessageBase);
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::Receive(const byte *pData, size_t count)
+{
+	while (count > 0)
+	{
+		size_t space;
+		byte *pBuffer = ReceiveBuffer(space);
+
+		space = min(space, count);
+		memcpy(pBuffer, pData, space);
+		Received(space);
+
+		pData += space;
+		count -= space;
+	}
+}
+
+
+bool
+BalBoa::SpaProtocol::ReceivePending() const
+{
+	return !_decoder.Idle();
+}
+
+
+void
+BalBoa::SpaProtocol::OnConnected()
+{
+	_lastMessageTime = millis();
+
+	_decoder.Reset();
+	_link.Connected(_lastMessageTime);
+
+	//  Once we re-connect, see if there are messages we are expecting.  If so,
+	//  resend the request.
+	auto oldWaiting = _waitingForMessages;
+
+	//  We *always* want a status message when we connect.
+	_waitingForMessages = wfmStatus;
+
+	if (oldWaiting & wfmConfig)
+	{
+		SendConfigRequest();
+	}
+
+	if (oldWaiting & wfmFilter)
+	{
+		SendFilterConfigRequest();
+	}
+
+	if (oldWaiting & wfmControlConfig)
+	{
+		SendControlConfigRequest();
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::SendFilterConfigRequest()
+{
+	if (!(_waitingForMessages & wfmFilter))
+	{
+		FilterConfigRequest message;
+
+		SendMessage(&message);
+
+		_waitingForMessages |= wfmFilter;
+	}
+}
+
+void
+BalBoa::SpaProtocol::SendConfigRequest()
+{
+	if (!(_waitingForMessages & wfmConfig))
+	{
+		ConfigRequest message;
+		SendMessage(&message);
+
+		_waitingForMessages |= wfmConfig;
+	}
+}
+
+void
+BalBoa::SpaProtocol::SendControlConfigRequest()
+{
+	if (!(_waitingForMessages & wfmControlConfig))
+	{
+		ControlConfigRequest message(true);
+		SendMessage(&message);
+
+		_waitingForMessages |= wfmControlConfig;
+	}
+}
+
+
+const BalBoa::SpaProtocol::Dispatch BalBoa::SpaProtocol::_dispatch[] PROGMEM =
+{
+#define BALBOA_DISPATCH(name, id, handler)                                       \
+	{&BalBoa::SpaProtocol::handler, BalBoa::name##Payload::length},
+	BALBOA_SPA_MESSAGES(BALBOA_DISPATCH)
+#undef BALBOA_DISPATCH
+};
+
+
+void
+BalBoa::SpaProtocol::ProcessMessage(
+	const BalBoa::MessageBase *pMessageBase)
+{
+	static_assert(sizeof(_dispatch) / sizeof(_dispatch[0]) == miCOUNT, "One handler per message");
+
+	const uint32_t id = pMessageBase->Id();
+	const SpaMessageIndex index = SpaMessage(id);
+
+	_lastMessageTime = millis();
+
+	BALBOA_TRACE(teFrame, id >> 8);
+
+	if (index == miCOUNT)
+	{
+		BALBOA_TRACE(teUnknownMessage, id >> 8);
+		BALBOA_LOG_INFO(F("Unknown message!"));
+		BALBOA_LOG_DUMP(BALBOA_LEVEL_INFO, pMessageBase, pMessageBase->_length + 2);
+		return;
+	}
+
+	Dispatch dispatch;
+
+	memcpy_P(&dispatch, &_dispatch[index], sizeof(dispatch));
+
+	//  The fields would be read from past the end.
+	if (pMessageBase->PayloadLength() < dispatch.length)
+	{
+		BALBOA_TRACE(teUnknownMessage, id >> 8);
+		BALBOA_LOG_INFO(F("Message too short!"));
+		BALBOA_LOG_DUMP(BALBOA_LEVEL_INFO, pMessageBase, pMessageBase->_length + 2);
+		return;
+	}
+
+#if BALBOA_LOG_LEVEL >= BALBOA_LEVEL_DEBUG
+	if (LogOutput)
+	{
+		pMessageBase->DumpFields(*LogOutput, true);
+	}
+#endif
+
+	(this->*dispatch.handler)(pMessageBase->Payload());
+}
+
+
+void
+BalBoa::SpaProtocol::StatusArrived(const byte *pPayload)
+{
+	_link.Arrived(_lastMessageTime);
+	CrackStatusMessage(pPayload);
+
+#if BALBOA_COMMAND_TRACKING
+	//  Even unchanged, it says which commands haven't happened.
+	_commands.StatusSeen(_lastMessageTime);
+#endif
+
+	if (_filters._filter1.stStart.hour == UNKNOWN_VAL)
+	{
+		//  We wait until a status message has arrived so we
+		//  know the right time format
+		SendFilterConfigRequest();
+	}
+}
+
+
+BalBoa::SpaState
+BalBoa::SpaProtocol::GetState() const
+{
+	SpaState state;
+
+#if BALBOA_SNAPSHOT
+	_snapshot.Read(state);
+#else
+	BuildState(state);
+#endif
+
+	return state;
+}
+
+
+unsigned int
+BalBoa::SpaProtocol::ChangesSince(BalBoa::ChangeCursor &cursor) const
+{
+	unsigned int changes = 0;
+
+	for (byte i = 0; i < changeFlags; i++)
+	{
+		if (_generations[i] > cursor.seen)
+		{
+			changes |= 1u << i;
+		}
+	}
+
+	cursor.seen = _stateUpdates;
+
+	return changes;
+}
+
+
+void
+BalBoa::SpaProtocol::StateChanged(unsigned int changes)
+{
+	_stateUpdates++;
+
+	for (byte i = 0; i < changeFlags; i++)
+	{
+		if (changes & (1u << i))
+		{
+			_generations[i] = _stateUpdates;
+		}
+	}
+
+#if BALBOA_SNAPSHOT
+	SpaState state;
+
+	BuildState(state);
+	_snapshot.Publish(state);
+#endif
+}
+
+
+bool
+BalBoa::SpaProtocol::SaveState(BalBoa::SpaState &state) const
+{
+	if (_handledChanges == 0)
+	{
+		return false;
+	}
+
+	BuildState(state);
+
+	return true;
+}
+
+
+void
+BalBoa::SpaProtocol::TriggerChanges()
+{
+	_changes = scMASK;
+
+	SpaState state;
+
+	if (SaveState(state))
+	{
+		CallCallbacks(scMASK, state);
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::SetChangeCallback(
+	unsigned int changes,
+	BalBoa::SpaProtocol::ChangeCallback callback,
+	void *pContext)
+{
+	for (byte i = 0; i < changeFlags; i++)
+	{
+		if (changes & (1u << i))
+		{
+			_callbacks[i].callback = callback;
+			_callbacks[i].pContext = pContext;
+		}
+	}
+
+	if (callback)
+	{
+		_handledChanges |= changes & scMASK;
+	}
+	else
+	{
+		_handledChanges &= ~changes;
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::CallCallbacks(unsigned int changes, const BalBoa::SpaState &before)
+{
+	changes &= _handledChanges;
+
+	if (changes == 0)
+	{
+		return;
+	}
+
+	SpaState after;
+
+	BuildState(after);
+
+	for (byte i = 0; i < changeFlags; i++)
+	{
+		const unsigned int change = 1u << i;
+
+		if ((changes & change) && _callbacks[i].callback)
+		{
+			_callbacks[i].callback(static_cast<SpaChanges>(change), before, after,
+								   _callbacks[i].pContext);
+		}
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::RecordHistory()
+{
+#if BALBOA_HISTORY_SIZE > 0
+	HistorySample sample;
+
+	sample.temp = _currentTemp.temp;
+	sample.setPoint = _setPoint.temp;
+	sample.celsiusX2 = (_tempCelsius == tsTrue);
+	sample.heating = _heating;
+	sample.lights = _lights;
+	sample.pump1 = _pump1Speed;
+	sample.pump2 = _pump2Speed;
+
+	_history.Record(millis(), sample);
+#endif
+}
+
+
+void
+BalBoa::SpaProtocol::BuildState(BalBoa::SpaState &state) const
+{
+	//  Padding too, so states can be compared with memcmp().
+	memset(&state, 0, sizeof(state));
+
+	state.updates = _stateUpdates;
+	state.time = _time;
+	state.currentTemp = _currentTemp;
+	state.setPoint = _setPoint;
+	state.highRange = _rangeHigh;
+	state.celsius = _tempCelsius;
+	state.pump1 = _pump1Speed;
+	state.pump2 = _pump2Speed;
+	state.recirc = _recirc;
+	state.timeUnset = _timeUnset;
+	state.heating = _heating;
+	state.lights = _lights;
+	state.priming = _priming;
+	state.panelMessages = _messages;
+	state.runningFilter = CurrentFilter();
+	state.filters = _filters;
+	state.version = _version;
+
+	//  As GetFilterInfo() does.
+	state.filters._filter1.stStart.displayAs24Hr = _time.displayAs24Hr;
+	state.filters._filter2.stStart.displayAs24Hr = _time.displayAs24Hr;
+}
+
+
+const BalBoa::SpaTime &
+BalBoa::SpaProtocol::GetSpaTime() const
+{
+	_changes &= ~scTime;
+
+	return _time;
+}
+
+
+const BalBoa::SpaTemp &
+BalBoa::SpaProtocol::GetSpaTemp() const
+{
+	_changes &= ~scTemp;
+
+	return _currentTemp;
+}
+
+
+const BalBoa::SpaTemp &
+BalBoa::SpaProtocol::GetSetTemp() const
+{
+	_changes &= ~scSetPoint;
+
+	return _setPoint;
+}
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsRecirc() const
+{
+	_changes &= ~scRecirc;
+
+	return _recirc;
+}
+
+BalBoa::PumpSpeed
+BalBoa::SpaProtocol::GetPump1Speed() const
+{
+	_changes &= ~scPump1;
+
+	return _pump1Speed;
+}
+
+
+BalBoa::PumpSpeed
+BalBoa::SpaProtocol::GetPump2Speed() const
+{
+	_changes &= ~scPump2;
+
+	return _pump2Speed;
+}
+
+
+
+const BalBoa::FilterInfo &
+BalBoa::SpaProtocol::GetFilterInfo() const
+{
+	_changes &= ~scFilterTimes;
+
+	//  Make sure we have the latest time format.
+	_filters._filter1.stStart.displayAs24Hr = _time.displayAs24Hr;
+	_filters._filter2.stStart.displayAs24Hr = _time.displayAs24Hr;
+
+	return _filters;
+}
+
+BalBoa::RunningFilter
+BalBoa::SpaProtocol::GetRunningFilter() const
+{
+	_changes &= ~scFilterRunning;
+
+	return CurrentFilter();
+}
+
+
+bool
+BalBoa::SpaProtocol::Active() const
+{
+	return (_heating == tsTrue) || (_priming == tsTrue)
+		|| ((_pump1Speed != psOff) && (_pump1Speed != psUNKNOWN))
+		|| ((_pump2Speed != psOff) && (_pump2Speed != psUNKNOWN));
+}
+
+
+BalBoa::RunningFilter
+BalBoa::SpaProtocol::CurrentFilter() const
+{
+	BalBoa::RunningFilter rf = rfNone;
+
+	if (_filter1Running == tsTrue)
+	{
+		rf = rf1;
+	}
+	else if (_filter2Running == tsTrue)
+	{
+		rf = rf2;
+	}
+
+	return rf;
+}
+
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsTimeUnset() const
+{
+	return _timeUnset;
+}
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsHeating() const
+{
+	_changes &= ~scHeating;
+
+	return _heating;
+}
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsLightOn() const
+{
+	_changes &= ~scLights;
+
+	return _lights;
+}
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsHighRange() const
+{
+	return _rangeHigh;
+}
+
+
+const BalBoa::VersionInfo &
+BalBoa::SpaProtocol::GetVersion() const
+{
+	_changes &= ~scVersion;
+
+	return _version;
+}
+
+
+uint8_t
+BalBoa::SpaProtocol::GetPanelMessages() const
+{
+	_changes &= ~scPanelMessages;
+	return _messages;
+}
+
+
+BalBoa::TriState
+BalBoa::SpaProtocol::IsPriming() const
+{
+	_changes &= ~scPriming;
+
+	return _priming;
+}
+
+
+void
+BalBoa::SpaProtocol::SetTime(
+	const BalBoa::SpaTime &time)
+{
+	SetSpaTime newTime(time);
+
+	//  Mark current time as unknown to force update.
+	_time.hour = UNKNOWN_VAL;
+	_time.minute = UNKNOWN_VAL;
+	_haveLastStatus = false;
+
+	TrackCommand(ctSetTime, &newTime, time.hour * 60 + time.minute, false);
+	SendMessage(&newTime);
+}
+
+
+void
+BalBoa::SpaProtocol::ToggleLights()
+{
+	ToggleItemMessage message(BalBoa::tiLights);
+
+	TrackToggle(ctLights, &message);
+	SendMessage(&message);
+}
+
+void
+BalBoa::SpaProtocol::TogglePump1()
+{
+	ToggleItemMessage message(BalBoa::tiPump1);
+
+	TrackCommand(ctPump1, &message, 0, true);
+	SendMessage(&message);
+}
+
+
+void
+BalBoa::SpaProtocol::TogglePump2()
+{
+	ToggleItemMessage message(BalBoa::tiPump2);
+
+	TrackCommand(ctPump2, &message, 0, true);
+	SendMessage(&message);
+}
+
+
+void
+BalBoa::SpaProtocol::ToggleTempRange()
+{
+	ToggleItemMessage message(BalBoa::tiTempRange);
+
+	TrackToggle(ctTempRange, &message);
+	SendMessage(&message);
+}
+
+
+void
+BalBoa::SpaProtocol::ToggleTempScale()
+{
+	if (_tempCelsius != tsUnknown)
+	{
+		SetSpaTempScaleMessage message(!(bool)_tempCelsius);
+
+		TrackCommand(ctTempScale, &message, !(bool)_tempCelsius, false);
+		SendMessage(&message);
+	}
+}
+
+void
+BalBoa::SpaProtocol::SetTemp(
+	const BalBoa::SpaTemp &temp)
+{
+	SetSpaTempMessage message(temp);
+
+	TrackCommand(ctSetTemp, &message, temp.temp, false);
+	SendMessage(&message);
+}
+
+
+BalBoa::CommandStatus
+BalBoa::SpaProtocol::GetCommandStatus(BalBoa::CommandType type) const
+{
+#if BALBOA_COMMAND_TRACKING
+	return _commands.GetStatus(type);
+#else
+	(void)type;
+	return csNone;
+#endif
+}
+
+
+void
+BalBoa::SpaProtocol::SetLights(bool on)
+{
+	SpaScene scene;
+
+	scene.lights = static_cast<TriState>(on);
+	SetScene(scene);
+}
+
+
+void
+BalBoa::SpaProtocol::SetPump(byte pump, BalBoa::PumpSpeed speed)
+{
+	SpaScene scene;
+
+	if (pump == 1)
+	{
+		scene.pump1 = speed;
+	}
+	else if (pump == 2)
+	{
+		scene.pump2 = speed;
+	}
+
+	SetScene(scene);
+}
+
+
+void
+BalBoa::SpaProtocol::SetTempRange(bool high)
+{
+	SpaScene scene;
+
+	scene.highRange = static_cast<TriState>(high);
+	SetScene(scene);
+}
+
+
+void
+BalBoa::SpaProtocol::SetScene(const BalBoa::SpaScene &scene)
+{
+	if (_sceneStatus != csPending)
+	{
+		_scene = SpaScene();
+	}
+
+	if (scene.lights != tsUnknown)
+	{
+		_scene.lights = scene.lights;
+	}
+
+	if (scene.pump1 != psUNKNOWN)
+	{
+		_scene.pump1 = scene.pump1;
+	}
+
+	if (scene.pump2 != psUNKNOWN)
+	{
+		_scene.pump2 = scene.pump2;
+	}
+
+	if (scene.highRange != tsUnknown)
+	{
+		_scene.highRange = scene.highRange;
+	}
+
+	if (scene.setTemp != UNKNOWN_VAL)
+	{
+		_scene.setTemp = scene.setTemp;
+	}
+
+	_sceneStatus = csPending;
+	_sceneRounds = 0;
+
+	PlanScene(true);
+}
+
+
+BalBoa::CommandStatus
+BalBoa::SpaProtocol::GetSceneStatus() const
+{
+	return _sceneStatus;
+}
+
+
+bool
+BalBoa::SpaProtocol::SceneReached() const
+{
+	return ((_scene.lights == tsUnknown) || (_scene.lights == _lights))
+		&& ((_scene.pump1 == psUNKNOWN) || (_scene.pump1 == _pump1Speed))
+		&& ((_scene.pump2 == psUNKNOWN) || (_scene.pump2 == _pump2Speed))
+		&& ((_scene.highRange == tsUnknown) || (_scene.highRange == _rangeHigh))
+		&& ((_scene.setTemp == UNKNOWN_VAL) || (_scene.setTemp == _setPoint.temp));
+}
+
+
+void
+BalBoa::SpaProtocol::PlanScene(bool now)
+{
+	if (_sceneStatus != csPending)
+	{
+		return;
+	}
+
+	//  Need to know where we're starting from.
+	if (((_scene.lights != tsUnknown) && (_lights == tsUnknown))
+		|| ((_scene.pump1 != psUNKNOWN) && (_pump1Speed == psUNKNOWN))
+		|| ((_scene.pump2 != psUNKNOWN) && (_pump2Speed == psUNKNOWN))
+		|| ((_scene.highRange != tsUnknown) && (_rangeHigh == tsUnknown))
+		|| ((_scene.setTemp != UNKNOWN_VAL) && (_setPoint.temp == UNKNOWN_VAL)))
+	{
+		return;
+	}
+
+	if (SceneReached())
+	{
+		_sceneStatus = csConfirmed;
+		_sceneSent = SpaScene();
+		return;
+	}
+
+	//  While the tracker still has some of the last batch pending, re-sending is up to it
+	//  (CheckCommands()), or the same toggle could go twice.
+	const bool settled = ((millis() - _scenePlanned) >= BALBOA_SCENE_SETTLE) && !SceneCommandsPending();
+
+	if (settled)
+	{
+		//  Whatever was sent has landed (or got lost), start again from the status.
+		_sceneSent = SpaScene();
+	}
+	else if (!now)
+	{
+		return;
+	}
+
+	//  Where things will be once the last batch takes effect.
+	const TriState lights = (_sceneSent.lights != tsUnknown) ? _sceneSent.lights : _lights;
+	const PumpSpeed pump1 = (_sceneSent.pump1 != psUNKNOWN) ? _sceneSent.pump1 : _pump1Speed;
+	const PumpSpeed pump2 = (_sceneSent.pump2 != psUNKNOWN) ? _sceneSent.pump2 : _pump2Speed;
+	const TriState highRange = (_sceneSent.highRange != tsUnknown) ? _sceneSent.highRange : _rangeHigh;
+	const byte setPoint = (_sceneSent.setTemp != UNKNOWN_VAL) ? _sceneSent.setTemp : _setPoint.temp;
+
+	//  Off -> low -> high -> off
+	const byte pump1Toggles = (_scene.pump1 == psUNKNOWN) ? 0 : (_scene.pump1 + 3 - pump1) % 3;
+	const byte pump2Toggles = (_scene.pump2 == psUNKNOWN) ? 0 : (_scene.pump2 + 3 - pump2) % 3;
+	const bool toggleRange = (_scene.highRange != tsUnknown) && (_scene.highRange != highRange);
+	const bool toggleLights = (_scene.lights != tsUnknown) && (_scene.lights != lights);
+	const bool setTemp = (_scene.setTemp != UNKNOWN_VAL) && (_scene.setTemp != setPoint);
+
+	if (!pump1Toggles && !pump2Toggles && !toggleRange && !toggleLights && !setTemp)
+	{
+		//  Already on its way.
+		return;
+	}
+
+	if (_sceneRounds >= BALBOA_SCENE_ROUNDS)
+	{
+		BALBOA_LOG_WARN(F("Spa didn't reach scene!"));
+
+		_sceneStatus = csFailed;
+		_sceneSent = SpaScene();
+		return;
+	}
+
+	_sceneRounds++;
+	_scenePlanned = millis();
+
+	//  Range first, the set point may not be valid in the old one.
+	if (toggleRange)
+	{
+		ToggleTempRange();
+		_sceneSent.highRange = _scene.highRange;
+	}
+
+	if (setTemp)
+	{
+		SpaTemp temp = {_scene.setTemp, _setPoint.isCelsiusX2};
+
+		SetTemp(temp);
+		_sceneSent.setTemp = _scene.setTemp;
+	}
+
+	if (toggleLights)
+	{
+		ToggleLights();
+		_sceneSent.lights = _scene.lights;
+	}
+
+	for (byte i = 0; i < pump1Toggles; i++)
+	{
+		TogglePump1();
+	}
+
+	for (byte i = 0; i < pump2Toggles; i++)
+	{
+		TogglePump2();
+	}
+
+	if (pump1Toggles)
+	{
+		_sceneSent.pump1 = _scene.pump1;
+	}
+
+	if (pump2Toggles)
+	{
+		_sceneSent.pump2 = _scene.pump2;
+	}
+}
+
+
+bool
+BalBoa::SpaProtocol::SceneCommandsPending() const
+{
+#if BALBOA_COMMAND_TRACKING
+	static const CommandType sceneCommands[] = {ctLights, ctPump1, ctPump2, ctTempRange, ctSetTemp};
+
+	for (CommandType type : sceneCommands)
+	{
+		if (_commands.GetStatus(type) == csPending)
+		{
+			return true;
+		}
+	}
+#endif
+
+	return false;
+}
+
+
+bool
+BalBoa::SpaProtocol::CommandsPending() const
+{
+#if BALBOA_COMMAND_TRACKING
+	if (_commands.Pending())
+	{
+		return true;
+	}
+#endif
+
+	return _sceneStatus == csPending;
+}
+
+
+void
+BalBoa::SpaProtocol::CheckCommands()
+{
+	if ((_sceneStatus == csPending) && ((millis() - _scenePlanned) >= BALBOA_SCENE_SETTLE))
+	{
+		PlanScene(false);
+	}
+
+#if BALBOA_COMMAND_TRACKING
+	if (!_commands.Pending())
+	{
+		return;
+	}
+
+	const unsigned long now = millis();
+
+	for (byte type = 0; type < ctCOUNT; type++)
+	{
+		if (_commands.RetryDue(static_cast<CommandType>(type), now))
+		{
+			BALBOA_LOG_INFO(F("Command not confirmed, sending again"));
+
+			SendMessage(_commands.GetMessage(static_cast<CommandType>(type)));
+		}
+	}
+#endif
+}
+
+
+#if BALBOA_COMMAND_TRACKING
+namespace
+{
+	uint16_t KnownValue(byte value)
+	{
+		return (value == BalBoa::UNKNOWN_VAL) ? BalBoa::CommandTracker::unknownValue : value;
+	}
+}
+#endif
+
+
+uint16_t
+BalBoa::SpaProtocol::CommandValue(BalBoa::CommandType type) const
+{
+#if BALBOA_COMMAND_TRACKING
+	switch (type)
+	{
+	case ctLights:
+		return KnownValue(_lights);
+
+	case ctPump1:
+		return KnownValue(_pump1Speed);
+
+	case ctPump2:
+		return KnownValue(_pump2Speed);
+
+	case ctTempRange:
+		return KnownValue(_rangeHigh);
+
+	case ctSetTemp:
+		return KnownValue(_setPoint.temp);
+
+	case ctTempScale:
+		return KnownValue(_tempCelsius);
+
+	case ctSetTime:
+		if ((_time.hour == UNKNOWN_VAL) || (_time.minute == UNKNOWN_VAL))
+		{
+			return CommandTracker::unknownValue;
+		}
+		return _time.hour * 60 + _time.minute;
+
+	default:
+		break;
+	}
+
+	return CommandTracker::unknownValue;
+#else
+	(void)type;
+	return 0;
+#endif
+}
+
+
+void
+BalBoa::SpaProtocol::TrackCommand(
+	BalBoa::CommandType type,
+	const BalBoa::MessageBase *pMessage,
+	uint16_t expected,
+	bool expectChange)
+{
+#if BALBOA_COMMAND_TRACKING
+	_commands.Sent(type, pMessage, CommandValue(type), expected, expectChange, millis());
+#else
+	(void)type, (void)pMessage, (void)expected, (void)expectChange;
+#endif
+}
+
+
+//  On / off toggles:  expect the opposite of where things will be once any toggle
+//  already waiting has been applied.
+void
+BalBoa::SpaProtocol::TrackToggle(
+	BalBoa::CommandType type,
+	const BalBoa::MessageBase *pMessage)
+{
+#if BALBOA_COMMAND_TRACKING
+	const uint16_t target = _commands.Target(type, CommandValue(type));
+
+	TrackCommand(type, pMessage,
+				 (target == CommandTracker::unknownValue) ? target : (uint16_t)!target, false);
+#else
+	(void)type, (void)pMessage;
+#endif
+}
+
+
+namespace
+{
+	//  Which change flags each decoded field of the status payload feeds.
+	struct StatusField
+	{
+		byte offset;
+		byte mask;
+		uint16_t changes;
+	};
+
+#define BALBOA_STATUS_FIELD(name, changes)                                       \
+	{BalBoa::StatusPayload::name::offset,                                        \
+	 (byte)(BalBoa::StatusPayload::name::mask << BalBoa::StatusPayload::name::shift), changes}
+
+	const StatusField statusFields[] PROGMEM =
+	{
+		BALBOA_STATUS_FIELD(Priming, BalBoa::scPriming),
+		BALBOA_STATUS_FIELD(CurrentTemp, BalBoa::scTemp),
+		BALBOA_STATUS_FIELD(Hour, BalBoa::scTime),
+		BALBOA_STATUS_FIELD(Minute, BalBoa::scTime),
+		BALBOA_STATUS_FIELD(PanelMessage, BalBoa::scPanelMessages),
+		BALBOA_STATUS_FIELD(TempScaleCelsius, BalBoa::scTemp | BalBoa::scSetPoint),
+		BALBOA_STATUS_FIELD(Display24Hr, BalBoa::scTime),
+		BALBOA_STATUS_FIELD(Filter1Running, BalBoa::scFilterRunning),
+		BALBOA_STATUS_FIELD(Filter2Running, BalBoa::scFilterRunning),
+		BALBOA_STATUS_FIELD(TempRange, BalBoa::scSetPoint),
+		BALBOA_STATUS_FIELD(Heating, BalBoa::scHeating),
+		BALBOA_STATUS_FIELD(Pump1, BalBoa::scPump1),
+		BALBOA_STATUS_FIELD(Pump2, BalBoa::scPump2),
+		BALBOA_STATUS_FIELD(CircPump, BalBoa::scRecirc),
+		BALBOA_STATUS_FIELD(Light, BalBoa::scLights),
+		BALBOA_STATUS_FIELD(TimeUnset, BalBoa::scTime),
+		BALBOA_STATUS_FIELD(SetTemp, BalBoa::scSetPoint),
+	};
+
+#undef BALBOA_STATUS_FIELD
+
+	static_assert(BalBoa::StatusPayload::length == BalBoa::SpaProtocol::statusPayloadLength,
+				  "Status payload length changed");
+}
+
+
+void
+BalBoa::SpaProtocol::DecodeStatus(const byte *pPayload, bool full)
+{
+	if (full)
+	{
+		_haveLastStatus = false;
+	}
+
+	CrackStatusMessage(pPayload);
+}
+
+
+void
+BalBoa::SpaProtocol::CrackStatusMessage(const byte *pPayload)
+{
+	typedef StatusPayload Status;
+
+	//  Nearly every status message is identical to the one before it.  Find out which
+	//  groups of fields could have changed, and only decode those.
+	unsigned int dirty = scMASK;
+
+	if (_haveLastStatus)
+	{
+		if (memcmp(pPayload, _lastStatus, statusPayloadLength) == 0)
+		{
+			return;
+		}
+
+		dirty = 0;
+
+		for (const StatusField &field : statusFields)
+		{
+			const byte offset = pgm_read_byte(&field.offset);
+
+			if ((pPayload[offset] ^ _lastStatus[offset]) & pgm_read_byte(&field.mask))
+			{
+				dirty |= pgm_read_word(&field.changes);
+			}
+		}
+	}
+
+#if BALBOA_ANALYZER
+	_analyzer.Record(ProtocolAnalyzer::srcStatus, pPayload, _lastMessageTime);
+#endif
+
+	memcpy(_lastStatus, pPayload, statusPayloadLength);
+	_haveLastStatus = true;
+
+	SpaState before;
+	const bool haveBefore = SaveState(before);
+
+	// Only mark this off if something changed.
+	// _waitingForMessages &= ~wfmStatus;
+
+	unsigned int newChanges = 0;
+
+	if (dirty & scTime)
+	{
+		if (Status::Hour::Get(pPayload) != _time.hour)
+		{
+			_time.hour = Status::Hour::Get(pPayload);
+			newChanges |= scTime;
+		}
+
+		if (Status::Minute::Get(pPayload) != _time.minute)
+		{
+			_time.minute = Status::Minute::Get(pPayload);
+			newChanges |= scTime;
+		}
+
+		if (Status::Display24Hr::Get(pPayload) != _time.displayAs24Hr)
+		{
+			_time.displayAs24Hr = Status::Display24Hr::Get(pPayload);
+			newChanges |= scTime;
+			newChanges |= scFilterTimes;  //  Because time format has changed.
+		}
+
+		if (Status::TimeUnset::Get(pPayload) != _timeUnset)
+		{
+			_timeUnset = static_cast<TriState>(Status::TimeUnset::Get(pPayload));
+			newChanges |= scTime;
+		}
+	}
+
+	if (dirty & scTemp)
+	{
+		if (Status::CurrentTemp::Get(pPayload) != _currentTemp.temp)
+		{
+			_currentTemp.temp = Status::CurrentTemp::Get(pPayload);
+			_currentTemp.isCelsiusX2 = Status::TempScaleCelsius::Get(pPayload);
+
+			newChanges |= scTemp;
+		}
+	}
+
+	if (dirty & scSetPoint)
+	{
+		if (Status::SetTemp::Get(pPayload) != _setPoint.temp)
+		{
+			_setPoint.temp = Status::SetTemp::Get(pPayload);
+			_setPoint.isCelsiusX2 = Status::TempScaleCelsius::Get(pPayload);
+
+			newChanges |= scSetPoint;
+		}
+
+		if (static_cast<TriState>(Status::TempRange::Get(pPayload)) != _rangeHigh)
+		{
+			_rangeHigh = static_cast<TriState>(Status::TempRange::Get(pPayload));
+			newChanges |= scSetPoint;
+		}
+	}
+
+	if (dirty & (scTemp | scSetPoint))
+	{
+		if (static_cast<TriState>(Status::TempScaleCelsius::Get(pPayload)) != _tempCelsius)
+		{
+			_tempCelsius = static_cast<TriState>(Status::TempScaleCelsius::Get(pPayload));
+			newChanges |= (scTemp | scSetPoint);
+		}
+	}
+
+	if (dirty & scPump1)
+	{
+		if (Status::Pump1::Get(pPayload) != _pump1Speed)
+		{
+			_pump1Speed = static_cast<BalBoa::PumpSpeed>(Status::Pump1::Get(pPayload));
+
+			newChanges |= scPump1;
+		}
+	}
+
+	if (dirty & scPump2)
+	{
+		if (Status::Pump2::Get(pPayload) != _pump2Speed)
+		{
+			_pump2Speed = static_cast<BalBoa::PumpSpeed>(Status::Pump2::Get(pPayload));
+
+			newChanges |= scPump2;
+		}
+	}
+
+	if (dirty & scLights)
+	{
+		if (static_cast<TriState>(Status::Light::Get(pPayload) != 0) != _lights)
+		{
+			_lights = static_cast<TriState>(Status::Light::Get(pPayload) != 0);
+			newChanges |= scLights;
+		}
+	}
+
+	if (dirty & scHeating)
+	{
+		if (static_cast<TriState>(Status::Heating::Get(pPayload) != 0) != _heating)
+		{
+			_heating = static_cast<TriState>(Status::Heating::Get(pPayload) != 0);
+			newChanges |= scHeating;
+		}
+	}
+
+	if (dirty & scRecirc)
+	{
+		if (static_cast<TriState>(Status::CircPump::Get(pPayload) != 0) != _recirc)
+		{
+			_recirc = static_cast<TriState>(Status::CircPump::Get(pPayload) != 0);
+			newChanges |= scRecirc;
+		}
+	}
+
+	if (dirty & scFilterRunning)
+	{
+		if (static_cast<TriState>(Status::Filter1Running::Get(pPayload) != 0) != _filter1Running)
+		{
+			_filter1Running = static_cast<TriState>(Status::Filter1Running::Get(pPayload) != 0);
+			newChanges |= scFilterRunning;
+		}
+
+		if (static_cast<TriState>(Status::Filter2Running::Get(pPayload) != 0) != _filter2Running)
+		{
+			_filter2Running = static_cast<TriState>(Status::Filter2Running::Get(pPayload) != 0);
+			newChanges |= scFilterRunning;
+		}
+	}
+
+	if (dirty & scPanelMessages)
+	{
+		if (Status::PanelMessage::Get(pPayload) != _messages)
+		{
+			_messages = Status::PanelMessage::Get(pPayload);
+			newChanges |= scPanelMessages;
+		}
+	}
+
+	if (dirty & scPriming)
+	{
+		if (static_cast<TriState>(Status::Priming::Get(pPayload) != 0) != _priming)
+		{
+			_priming = static_cast<TriState>(Status::Priming::Get(pPayload) != 0);
+			newChanges |= scPriming;
+		}
+	}
+
+	if (newChanges)
+	{
+		_waitingForMessages &= ~wfmStatus;
+
+		_changes |= Unhandled(newChanges);
+
+		StateChanged(newChanges);
+
+		if (newChanges & (scTemp | scSetPoint | scHeating | scLights | scPump1 | scPump2))
+		{
+			RecordHistory();
+		}
+
+#if BALBOA_COMMAND_TRACKING
+		if (_commands.Pending())
+		{
+			for (byte type = 0; type < ctCOUNT; type++)
+			{
+				_commands.Observe(static_cast<CommandType>(type),
+								  CommandValue(static_cast<CommandType>(type)), _lastMessageTime);
+			}
+		}
+#endif
+
+		//  Done yet?  Or, for a scene set before we knew the state, time to start.
+		PlanScene(_sceneRounds == 0);
+
+		if (haveBefore)
+		{
+			CallCallbacks(newChanges, before);
+		}
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::CrackConfigMessage(const byte *pPayload)
+{
+#if BALBOA_ANALYZER
+	_analyzer.Record(ProtocolAnalyzer::srcConfig, pPayload, _lastMessageTime);
+#else
+	(void)pPayload;
+#endif
+
+	_waitingForMessages &= ~wfmConfig;
+}
+
+
+void
+BalBoa::SpaProtocol::CrackFilterMessage(const byte *pPayload)
+{
+	typedef FilterConfigPayload Filter;
+
+	SpaState before;
+	const bool haveBefore = SaveState(before);
+
+	_filters._filter1.stStart.hour = Filter::Filter1StartHour::Get(pPayload);
+	_filters._filter1.stStart.minute = Filter::Filter1StartMinute::Get(pPayload);
+	_filters._filter1.stStart.displayAs24Hr = _time.displayAs24Hr;
+	_filters._filter1.stDuration.hour = Filter::Filter1DurationHours::Get(pPayload);
+	_filters._filter1.stDuration.minute = Filter::Filter1DurationMinutes::Get(pPayload);
+	_filters._filter1.stDuration.displayAs24Hr = true;
+
+	_filters._filter2Enabled = Filter::Filter2Enabled::Get(pPayload);
+	_filters._filter2.stStart.hour = Filter::Filter2StartHour::Get(pPayload);
+	_filters._filter2.stStart.minute = Filter::Filter2StartMinute::Get(pPayload);
+	_filters._filter2.stStart.displayAs24Hr = _time.displayAs24Hr;
+	_filters._filter2.stDuration.hour = Filter::Filter2DurationHours::Get(pPayload);
+	_filters._filter2.stDuration.minute = Filter::Filter2DurationMinutes::Get(pPayload);
+	_filters._filter2.stDuration.displayAs24Hr = true;
+
+	_changes |= Unhandled(scFilterTimes);
+
+	StateChanged(scFilterTimes);
+
+	_waitingForMessages &= ~wfmFilter;
+
+	OnInfoReceived(scFilterTimes);
+
+	if (haveBefore)
+	{
+		CallCallbacks(scFilterTimes, before);
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::CrackVersionMessage(const byte *pPayload)
+{
+	typedef ControlConfigPayload Version;
+
+	SpaState before;
+	const bool haveBefore = SaveState(before);
+
+	_version._currentSetup = Version::CurrentSetup::Get(pPayload);
+
+	memcpy(_version._version, Version::Version::Get(pPayload), Version::Version::length);
+
+	//  Unaligned, so a byte at a time.
+	_version._signature = Version::Signature::Get(pPayload);
+
+	memcpy(_version._name, Version::Name::Get(pPayload), Version::Name::length);
+	_version._name[Version::Name::length] = '\0';
+
+	_changes |= Unhandled(scVersion);
+
+	StateChanged(scVersion);
+
+	_waitingForMessages &= ~wfmControlConfig;
+
+	OnInfoReceived(scVersion);
+
+	if (haveBefore)
+	{
+		CallCallbacks(scVersion, before);
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::RestoreInfo(
+	const BalBoa::VersionInfo &version,
+	const BalBoa::FilterInfo &filters)
+{
+	SpaState before;
+	const bool haveBefore = SaveState(before);
+
+	_version = version;
+	_filters = filters;
+
+	_changes |= Unhandled(scVersion | scFilterTimes);
+
+	StateChanged(scVersion | scFilterTimes);
+
+	if (haveBefore)
+	{
+		CallCallbacks(scVersion | scFilterTimes, before);
+	}
+}
+
+
+void
+BalBoa::SpaProtocol::ResetState()
+{
+	_lastMessageTime = millis();
+
+	SpaState before;
+	const bool hadData = (_time.hour != UNKNOWN_VAL);
+	const bool haveBefore = hadData && SaveState(before);
+
+	//  If we had valid data, mark everything as changed.
+	if (hadData)
+	{
+		_changes |= Unhandled(scMASK);
+	}
+
+	_haveLastStatus = false;
+	_link.Reset();
+	_time = {UNKNOWN_VAL, UNKNOWN_VAL, true};
+	_currentTemp = {UNKNOWN_VAL, false};
+	_setPoint = {UNKNOWN_VAL, false};
+	_rangeHigh = tsUnknown;
+	_tempCelsius = tsUnknown;
+	_pump1Speed = psUNKNOWN;
+	_pump2Speed = psUNKNOWN;
+	_recirc = tsUnknown;
+	_timeUnset = tsUnknown;
+	_lights = tsUnknown;
+	_heating = tsUnknown;
+	_filter1Running = tsUnknown;
+	_filter2Running = tsUnknown;
+	_priming = tsUnknown;
+
+	// _ipHotTub = INADDR_NONE;
+
+	_filters = {{{UNKNOWN_VAL, UNKNOWN_VAL, true}, {UNKNOWN_VAL, UNKNOWN_VAL, true}},
+	{{UNKNOWN_VAL, UNKNOWN_VAL, true}, {UNKNOWN_VAL, UNKNOWN_VAL, true}}, true};
+
+
+	_version = {UNKNOWN_VAL, {UNKNOWN_VAL, UNKNOWN_VAL, UNKNOWN_VAL}, 0xFFFFFFFF, {'\0'}};
+
+	_messages = pmNone;
+
+	//  Cursors see everything as changed, even the first time.
+	StateChanged(scMASK);
+
+	if (hadData)
+	{
+		//  A gap in the history.
+		RecordHistory();
+	}
+
+	if (haveBefore)
+	{
+		CallCallbacks(scMASK, before);
+	}
+}
+
@@ -0,0 +1,171 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaQueue.h"
+#include "BalBoaLog.h"
+
+static_assert(sizeof(BalBoa::FilterConfigRequest) <= BalBoa::CommandQueue::maxMessageLength,
+			  "Outgoing message too long for CommandQueue");
+static_assert(sizeof(BalBoa::SetSpaTime) <= BalBoa::CommandQueue::maxMessageLength,
+			  "Outgoing message too long for CommandQueue");
+
+
+BalBoa::CommandQueue::CommandQueue()
+	: _count(0)
+{
+}
+
+
+void
+BalBoa::CommandQueue::Clear()
+{
+	_count = 0;
+}
+
+
+bool
+BalBoa::CommandQueue::Add(const BalBoa::MessageBase *pMessage)
+{
+	const byte size = pMessage->_length + 2;
+	const uint32_t type = pMessage->Id();
+
+	for (byte i = 0; i < _count; i++)
+	{
+		Entry &entry = _entries[i];
+
+		if (Message(entry)->Id() != type)
+		{
+			continue;
+		}
+
+		switch (type)
+		{
+		case msToggleItemRequest:
+		{
+			const byte item = ToggleItemPayload::Item::Get(pMessage->Payload());
+
+			if ((item != tiLights) && (item != tiTempRange))
+			{
+				break;
+			}
+
+			if (ToggleItemPayload::Item::Get(Message(entry)->Payload()) == item)
+			{
+				BALBOA_LOG_DEBUG(F("Toggles cancelled"));
+
+				Remove(i, 1);
+				return true;
+			}
+			break;
+		}
+
+		case msSetTempRequest:
+		case msSetTimeRequest:
+		case msSetTempScaleRequest:
+			//  Latest value wins, and goes after whatever was queued in between (a
+			//  temp range toggle must still go before the set temp).  There's never
+			//  more than one of these, so the rest of the queue needs no checking.
+			Remove(i, 1);
+			break;
+
+		default:
+			//  Same request already waiting.
+			if ((entry.size == size) && (memcmp(entry.bytes, pMessage, size) == 0))
+			{
+				return true;
+			}
+			break;
+		}
+	}
+
+	if (_count == BALBOA_QUEUE_SIZE)
+	{
+		return false;
+	}
+
+	Entry &entry = _entries[_count++];
+
+	memcpy(entry.bytes, pMessage, size);
+	entry.size = size;
+
+	return true;
+}
+
+
+size_t
+BalBoa::CommandQueue::Take(
+	byte count,
+	byte (&buffer)[BALBOA_SEND_BURST * maxMessageLength])
+{
+	count = min(count, min(_count, (byte)BALBOA_SEND_BURST));
+
+	size_t used = 0;
+
+	for (byte i = 0; i < count; i++)
+	{
+		memcpy(buffer + used, _entries[i].bytes, _entries[i].size);
+		used += _entries[i].size;
+
+		BALBOA_TRACE(teSend, Message(_entries[i])->Id() >> 8);
+	}
+
+	Remove(0, count);
+
+	return used;
+}
+
+
+void
+BalBoa::CommandQueue::Remove(byte index, byte count)
+{
+	for (byte i = index; i + count < _count; i++)
+	{
+		_entries[i] = _entries[i + count];
+	}
+
+	_count -= count;
+}
+
+
+BalBoa::TokenBucket::TokenBucket()
+	: _tokens(BALBOA_SEND_BURST), _refillTime(0)
+{
+}
+
+
+byte
+BalBoa::TokenBucket::Available()
+{
+	const unsigned long now = millis();
+	const unsigned long refills = (now - _refillTime) / BALBOA_SEND_INTERVAL;
+
+	if (refills > 0)
+	{
+		if (_tokens + refills >= BALBOA_SEND_BURST)
+		{
+			_tokens = BALBOA_SEND_BURST;
+			_refillTime = now;
+		}
+		else
+		{
+			_tokens += refills;
+			_refillTime += refills * BALBOA_SEND_INTERVAL;
+		}
+	}
+
+	return _tokens;
+}
+
+
+void
+BalBoa::TokenBucket::Use(byte count)
+{
+	//  A full bucket starts refilling from now.
+	if (_tokens == BALBOA_SEND_BURST)
+	{
+		_refillTime = millis();
+	}
+
+	_tokens -= min(count, _tokens);
+}
@@ -0,0 +1,89 @@
+//  Outgoing commands, held until they can be sent.
+//
+//  CommandQueue merges commands that haven't gone out yet:  a second toggle of the lights
+//  or temperature range cancels the first, a newer set temp / set time / temp scale
+//  replaces the older one (and joins the back of the queue), and a repeated request is
+//  dropped.  Pump toggles are kept as is, as a pump has 2 or 3 speeds depending on the spa.
+//
+//  TokenBucket paces sending, as the Wi-Fi module is known to drop commands that arrive
+//  too close together.
+
+#ifndef _BALBOAQUEUE_h
+#define _BALBOAQUEUE_h
+
+#if !defined BALBOA_QUEUE_SIZE
+#if defined ARDUINO_ARCH_AVR
+#define BALBOA_QUEUE_SIZE 4
+#else
+#define BALBOA_QUEUE_SIZE 8
+#endif
+#endif
+
+//  Up to BALBOA_SEND_BURST commands at once, then one every BALBOA_SEND_INTERVAL ms.
+#if !defined BALBOA_SEND_BURST
+#define BALBOA_SEND_BURST 3
+#endif
+
+#if !defined BALBOA_SEND_INTERVAL
+#define BALBOA_SEND_INTERVAL 200
+#endif
+
+namespace BalBoa
+{
+	class CommandQueue
+	{
+	public:
+		//  Longest outgoing message, FilterConfigRequest.
+		static constexpr byte maxMessageLength = 10;
+
+		CommandQueue();
+
+		void Clear();
+
+		//  Message must be complete, check byte and all.  False if the queue is full.
+		bool Add(const MessageBase *);
+
+		byte Count() const
+		{
+			return _count;
+		};
+
+		//  Copies the oldest 'count' (at most) messages, back to back, and removes them
+		//  from the queue.  Returns the number of bytes copied.
+		size_t Take(byte count, byte (&buffer)[BALBOA_SEND_BURST * maxMessageLength]);
+
+	private:
+		struct Entry
+		{
+			byte size;
+			byte bytes[maxMessageLength];
+		};
+
+		static const MessageBase *Message(const Entry &entry)
+		{
+			return reinterpret_cast<const MessageBase *>(entry.bytes);
+		};
+
+		void Remove(byte index, byte count);
+
+		Entry _entries[BALBOA_QUEUE_SIZE];
+		byte _count;
+	};
+
+
+	class TokenBucket
+	{
+	public:
+		TokenBucket();
+
+		//  Tokens available now, up to BALBOA_SEND_BURST.
+		byte Available();
+		void Use(byte count);
+
+	private:
+		byte _tokens;
+		unsigned long _refillTime;
+	};
+}
+
+#endif
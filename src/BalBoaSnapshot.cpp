@@ -0,0 +1,92 @@
+
+#include "BalBoaPlatform.h"
+#include "BalBoaSpa.h"
+#include "BalBoaSnapshot.h"
+
+#if BALBOA_SNAPSHOT
+
+#if !defined ARDUINO
+#include <thread>
+#endif
+
+
+namespace
+{
+	//  Lets a writer that was preempted half way through, on the same core, finish.
+	void YieldToWriter()
+	{
+#if defined ARDUINO
+		yield();
+#else
+		std::this_thread::yield();
+#endif
+	}
+}
+
+
+BalBoa::StateSnapshot::StateSnapshot()
+	: _sequence(0)
+{
+	for (size_t i = 0; i < words; i++)
+	{
+		_words[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+
+void
+BalBoa::StateSnapshot::Publish(const BalBoa::SpaState &state)
+{
+	uint32_t buffer[words] = {};
+
+	memcpy(buffer, &state, sizeof(state));
+
+	const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+
+	//  Odd while the words are inconsistent.
+	_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (size_t i = 0; i < words; i++)
+	{
+		_words[i].store(buffer[i], std::memory_order_relaxed);
+	}
+
+	_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+void
+BalBoa::StateSnapshot::Read(BalBoa::SpaState &state) const
+{
+	uint32_t buffer[words];
+
+	for (;;)
+	{
+		const uint32_t before = _sequence.load(std::memory_order_acquire);
+
+		if (before & 1)
+		{
+			YieldToWriter();
+			continue;
+		}
+
+		for (size_t i = 0; i < words; i++)
+		{
+			buffer[i] = _words[i].load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (_sequence.load(std::memory_order_relaxed) == before)
+		{
+			break;
+		}
+
+		YieldToWriter();
+	}
+
+	memcpy(&state, buffer, sizeof(state));
+}
+
+#endif
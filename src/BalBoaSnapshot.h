@@ -0,0 +1,55 @@
+//  Consistent copies of the spa state for other tasks or cores.
+//
+//  After every change the protocol code publishes a SpaState (SpaProtocol::GetState()),
+//  and readers copy it out through a sequence lock:  the writer makes the sequence number
+//  odd while it updates the copy, then even again, and a reader only keeps what it copied
+//  if the number was even and unchanged throughout.  The writer never waits, a reader only
+//  goes round again if it overlapped a publish (at most a few times a second), yielding
+//  first in case it has preempted the writer, and neither takes a lock.  Reading doesn't
+//  touch the change flags.
+//
+//  On by default on ESP32 (two cores) and Linux.  Elsewhere GetState() just copies the
+//  current state, which is only safe from the code that calls GetChanges().  Define
+//  BALBOA_SNAPSHOT to override.
+
+#ifndef _BALBOASNAPSHOT_h
+#define _BALBOASNAPSHOT_h
+
+#if !defined BALBOA_SNAPSHOT
+#if defined ARDUINO_ARCH_ESP32 || !defined ARDUINO
+#define BALBOA_SNAPSHOT 1
+#else
+#define BALBOA_SNAPSHOT 0
+#endif
+#endif
+
+#if BALBOA_SNAPSHOT
+
+#include <atomic>
+
+namespace BalBoa
+{
+	class StateSnapshot
+	{
+	public:
+		StateSnapshot();
+
+		//  One writer at a time.
+		void Publish(const SpaState &);
+
+		//  Any number of readers, from anywhere.
+		void Read(SpaState &) const;
+
+	private:
+		//  Copied a word at a time, through atomics, so there's no data race for the
+		//  compiler to take liberties with.
+		static constexpr size_t words = (sizeof(SpaState) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+		std::atomic<uint32_t> _sequence;
+		std::atomic<uint32_t> _words[words];
+	};
+}
+
+#endif
+
+#endif
@@ -1,924 +1,885 @@
 
-#include <Arduino.h>
+#include "BalBoaPlatform.h"
+#include "crc.h"
+#include "BalBoaSpa.h"
+#include "BalBoaMessages.h"
+#include "BalBoaCache.h"
+#include "BalBoaLog.h"
 
+#if defined BALBOA_HAVE_NETWORK
 
-//  Try to figure out what our networking classes are
-#if defined ARDUINO_ARCH_ESP8266
-#include <ESP8266WiFi.h>
-#include <WiFiUdp.h>
+//  The object that knows our own IP address.
 namespace
 {
+#if defined ARDUINO_ARCH_ESP8266
 	ESP8266WiFiClass &Networking = WiFi;
-	typedef WiFiUDP SpaUdp;
-}
 #elif defined ARDUINO_ARCH_ESP32
-#include <WiFi.h>
-namespace
-{
 	WiFiClass &Networking = WiFi;
-	typedef WiFiUDP SpaUdp;
-}
 #elif defined ARDUINO_ARCH_AVR
-#include <Ethernet.h>
-namespace
-{
 	EthernetClass &Networking = Ethernet;
-	typedef EthernetUDP SpaUdp;
-
-
-}
+#else
+	BalBoa::HostNetworking &Networking = BalBoa::HostNetwork;
 #endif
 
-#include "crc.h"
-#include "BalBoaSpa.h"
-#include "BalBoaMessages.h"
-
-
-BalBoa::BalBoaSpa::BalBoaSpa()
-{
-	F_CRC_InicializaTabla();
-	ResetInfo();
-}
-
-
-bool
-BalBoa::BalBoaSpa::begin(
-	unsigned long pollingInterval,
-	unsigned long connectionTimeout)
-{
-	SpaUdp Udp;
+#if !BALBOA_ASYNC_CONNECT
+	//  Blocks for no more than 'timeout' milli-seconds.
+	bool ConnectClient(SpaClient &client, const IPAddress &ip, uint16_t port,
+					   unsigned long timeout)
+	{
+#if defined ARDUINO_ARCH_ESP8266
+		client.setTimeout(timeout);
+		return client.connect(ip, port);
+#elif defined ARDUINO_ARCH_AVR
+		client.setConnectionTimeout((uint16_t)timeout);
+		return client.connect(ip, port);
+#else
+#error "Add this board to ConnectClient(), see BalBoaPlatform.h"
+#endif
+	}
+#endif
 
-	ResetInfo();
+	//  Opens the socket if need be.  On failure it's closed again, so the next try starts
+	//  clean.
+	bool BroadcastDiscovery(SpaUdp &udp, bool &udpOpen, uint16_t port)
+	{
+		if (!udpOpen)
+		{
+			if (!udp.begin(0))
+			{
+				return false;
+			}
 
-	_pollingInterval = pollingInterval;
+			udpOpen = true;
+		}
 
-	if (!Udp.begin(0))
-	{
-		return false;
-	}
+		IPAddress broadcast = Networking.localIP();
 
-	IPAddress broadcast = Networking.localIP();
+		broadcast[3] = 255;
 
-	broadcast[3] = 255;
+		if (!udp.beginPacket(broadcast, port))
+		{
+			udp.stop();
+			udpOpen = false;
+			return false;
+		}
 
-	if (!Udp.beginPacket(broadcast, _discoveryPort))
-	{
-		Udp.stop();
-		return false;
-	}
+		//  Anything at all is acceptable, so long as it starts with 'D'.
+		udp.write('D');
 
-	//  Anything at all is acceptable, so long as it starts with 'D'.
-	Udp.write('D');
+		if (!udp.endPacket())
+		{
+			udp.stop();
+			udpOpen = false;
+			return false;
+		}
 
-	if (!Udp.endPacket())
-	{
-		Udp.stop();
-		return false;
+		return true;
 	}
 
-	const unsigned long tStart = millis();
-
-	while ((millis() - tStart) < connectionTimeout)
+	//  Address of the next answer to a discovery broadcast, INADDR_NONE if none waiting.
+	IPAddress ReadDiscoveryAnswer(SpaUdp &udp)
 	{
-		if (Udp.parsePacket())
+		while (udp.parsePacket())
 		{
 			constexpr size_t buffSize = 256;
 			char buffer[buffSize + 1];
 
-			size_t responseSize = Udp.available();
+			size_t responseSize = udp.available();
 
 			responseSize = min(responseSize, buffSize);
 
-			responseSize = Udp.read(buffer, responseSize);
+			responseSize = udp.read(buffer, responseSize);
 
 			if (responseSize)
 			{
 				buffer[responseSize] = '\0';
 
-				_ipHotTub = Udp.remoteIP();
-
-				Udp.flush();
-				Udp.stop();
-
-				_client.setTimeout(connectionTimeout);
-
-				Reconnect();
-				SendConfigRequest();
-				SendControlConfigRequest();
-
-				//  Don't send the filter request yet, we want a status update to arrive
-				//  first to properly set the time format.
-				// SendFilterConfigRequest();
-				return true;
+				return udp.remoteIP();
 			}
 		}
-	}
 
-	Udp.flush();
-	Udp.stop();
+		return INADDR_NONE;
+	}
+}
 
-	return false;
+BalBoa::BalBoaSpa::BalBoaSpa()
+	: _connecting(false), _linkLost(false), _connectTime(0), _connectionTimeout(5000),
+	  _reconnect(BALBOA_RECONNECT_MIN, BALBOA_RECONNECT_MAX),
+	  _udpOpen(false), _searching(false), _discovery(_discoveryRetryMin, _discoveryRetryMax),
+#if BALBOA_CACHE
+	  _cacheValid(false), _tryingCache(false), _useCache(true),
+#endif
+	  _pollingInterval(60000), _handshakeStart(0), _handshakeUs(0), _receiveStart(0),
+	  _receiveUs(0), _receiveFrames(0)
+{
 }
 
 
 bool
-BalBoa::BalBoaSpa::spaLocated() const
+BalBoa::BalBoaSpa::begin(
+	unsigned long pollingInterval,
+	unsigned long connectionTimeout)
 {
-	return _ipHotTub != INADDR_NONE;
-}
+	_pollingInterval = pollingInterval;
+	_connectionTimeout = connectionTimeout;
 
+	if (_searching)
+	{
+		return true;
+	}
 
-BalBoa::BalBoaSpa::operator bool() const
-{
-	return spaLocated();
-}
+	ResetInfo();
 
+#if BALBOA_CACHE
+	//  Cleared by begin(IPAddress).
+	_useCache = true;
 
-void
-BalBoa::BalBoaSpa::disconnect()
-{
-	_client.stop();
+	if (ConnectFromCache())
+	{
+		return true;
+	}
+#endif
+
+	return StartDiscovery();
 }
 
 
-const IPAddress &
-BalBoa::BalBoaSpa::GetSpaIP()
+bool
+BalBoa::BalBoaSpa::begin(
+	const IPAddress &spa,
+	unsigned long pollingInterval,
+	unsigned long connectionTimeout)
 {
-	return _ipHotTub;
-}
+	_pollingInterval = pollingInterval;
+	_connectionTimeout = connectionTimeout;
 
+#if BALBOA_CACHE
+	_useCache = false;
+#endif
 
-unsigned long
-BalBoa::BalBoaSpa::getPollingInterval()
-{
-	return _pollingInterval;
+	ResetInfo();
+	SpaFound(spa);
+
+	return spaLocated();
 }
 
-void
-BalBoa::BalBoaSpa::setPollingInterval(
-	unsigned long seconds)
+
+bool
+BalBoa::BalBoaSpa::StartDiscovery()
 {
-	_pollingInterval = seconds;
+	_searching = true;
+	_discovery.Reset();
+
+	//  Even if this fails (network not up yet?), GetChanges() will keep trying.
+	return SendDiscovery();
 }
 
 
-void
-BalBoa::BalBoaSpa::SendFilterConfigRequest()
+bool
+BalBoa::BalBoaSpa::SendDiscovery()
 {
-	if (!(_waitingForMessages & wfmFilter))
-	{
-		FilterConfigRequest message;
+	//  Until an answer arrives.
+	_discovery.Attempt(millis());
+	_discovery.Failed();
 
-		SendMessage(&message);
+	BALBOA_TRACE(teDiscoverySent, _discovery.Wait());
 
-		_waitingForMessages |= wfmFilter;
-	}
+	return BroadcastDiscovery(_udp, _udpOpen, _discoveryPort);
 }
 
+
 void
-BalBoa::BalBoaSpa::SendConfigRequest()
+BalBoa::BalBoaSpa::PollDiscovery()
 {
-	if (!(_waitingForMessages & wfmConfig))
+	if (_udpOpen)
 	{
-		ConfigRequest message;
-		SendMessage(&message);
+		IPAddress spa = ReadDiscoveryAnswer(_udp);
 
-		_waitingForMessages |= wfmConfig;
+		if (spa != INADDR_NONE)
+		{
+			SpaFound(spa);
+			return;
+		}
 	}
-}
 
-void
-BalBoa::BalBoaSpa::SendControlConfigRequest()
-{
-	if (!(_waitingForMessages & wfmControlConfig))
+	if (_discovery.Ready(millis()))
 	{
-		ControlConfigRequest message(true);
-		SendMessage(&message);
+		BALBOA_LOG_DEBUG(F("No answer from spa, retrying discovery"));
 
-		_waitingForMessages |= wfmControlConfig;
+		SendDiscovery();
 	}
 }
 
 
 void
-BalBoa::BalBoaSpa::SendMessage(
-	BalBoa::MessageBase *pMessage)
+BalBoa::BalBoaSpa::SpaFound(const IPAddress &spa)
 {
+	_ipHotTub = spa;
 
-	Reconnect();
-	pMessage->SetCRC();
+	if (_udpOpen)
+	{
+		_udp.flush();
+		_udp.stop();
+		_udpOpen = false;
+	}
+	_searching = false;
 
+	BALBOA_TRACE(teDiscovered, _ipHotTub[3]);
 
-	_client.write((byte *)pMessage, pMessage->_length + 2);
-}
+	//  New address, no reason to wait.
+	_discovery.Reset();
+	_reconnect.Reset();
+	Reconnect();
+	SendConfigRequest();
+	SendControlConfigRequest();
 
-unsigned int BalBoa::BalBoaSpa::GetChanges()
-{
-	// Process incoming messages
-	if (_client.connected())
-	{
-		int available = _client.available();
+	//  Don't send the filter request yet, we want a status update to arrive
+	//  first to properly set the time format.
+	// SendFilterConfigRequest();
+}
 
-		while ((_bufferUsed >= 7) || (available > 0))
-		{
-			auto amountToRead = min(available, _maxMessageLength - _bufferUsed);
 
-			//  Docs are...  misleading.  I'm getting -1 return values on read()
-			//  sometimes.  
-			auto amountRead = _client.read(_messageBuffer + _bufferUsed, amountToRead);
+#if BALBOA_CACHE
+bool
+BalBoa::BalBoaSpa::ConnectFromCache()
+{
+	_cacheValid = LoadSpaCache(_cache);
 
-			if (amountRead < 0)
-			{
-				Serial.println(F("read() error!"));
-				Serial.println(amountToRead);
-
-				MessageBase *pMessageBase = reinterpret_cast<MessageBase *>(_messageBuffer);
-				pMessageBase->Dump(_bufferUsed);
-				_bufferUsed = 0;
-				_client.stop();
-				return _changes;
-			}
-			else
-			{
-				_bufferUsed += amountRead;
-			}
+	if (!_cacheValid)
+	{
+		return false;
+	}
 
-			//  Minimum possible message length is 7
-			if (_bufferUsed >= 7)
-			{
-				MessageBase *pMessageBase = reinterpret_cast<MessageBase *>(_messageBuffer);
-
-				if (pMessageBase->_prefix == '\x7e')
-				{
-					byte messageLength = pMessageBase->_length;
-					byte fullLength = messageLength + 2;
-
-					if (fullLength >= _maxMessageLength)
-					{
-						Serial.println(F("Length too long?"));
-						pMessageBase->Dump(_bufferUsed);
-						_bufferUsed = 0;
-					}
-
-					if (!pMessageBase->CheckCRC())
-					{
-						Serial.println(F("CRC mismatch?"));
-						Serial.println(pMessageBase->CalcCRC());
-
-						pMessageBase->Dump();
-					}
-
-					if (fullLength <= _bufferUsed)
-					{
-						if (_messageBuffer[fullLength - 1] == '\x7e')
-						{
-							unsigned long messageType = pMessageBase->_messageType;
-
-							_lastMessageTime = millis();
-
-							switch (messageType)
-							{
-							case msStatus:
-								CrackStatusMessage(_messageBuffer);
-								if (_filters._filter1.stStart.hour == UNKNOWN_VAL)
-								{
-									//  We wait until a status message has arrived so we
-									//  know the right time format
-									SendFilterConfigRequest();
-								}
-								break;
-
-							case msConfigResponse:
-								CrackConfigMessage(_messageBuffer);
-								break;
-
-							case msFilterConfig:
-								CrackFilterMessage(_messageBuffer);
-								break;
-
-							case msControlConfig:  //  It's really version info
-								CrackVersionMessage(_messageBuffer);
-								break;
-
-							case msControlConfig2:
-							case msSetTempRange:
-								//  Do nothing
-								break;
-
-							default:
-								Serial.println(F("Unknown message!"));
-								pMessageBase->Dump();
-								break;
-							}
-
-							if (_bufferUsed > fullLength)
-							{
-								memmove(_messageBuffer, _messageBuffer + fullLength, _bufferUsed - fullLength);
-								_bufferUsed -= fullLength;
-							}
-							else
-							{
-								_bufferUsed = 0;
-							}
-						}
-						else
-						{
-							Serial.println(F("Message missing terminators!"));
-							_bufferUsed = 0;
-						}
-					}
-					else
-					{
-						Serial.println(F("Await more data."));
-						Serial.println(_bufferUsed);
-						Serial.println(fullLength);
-					}
-				}
-				else
-				{
-					Serial.println(F("No prefix!"));
-					Serial.println(_bufferUsed);
-
-					//for (auto i = 0; i < _bufferUsed; i++)
-					//{
-					//	Serial.printf("%02X ", _messageBuffer[i]);
-					//}
-					Serial.println();
-					_bufferUsed = 0;
-				}
-			}
-			available = _client.available();
-		}
+	//  Show what we know straight away, even if we end up searching for the spa.
+	RestoreInfo(_cache._version, _cache._filters);
 
-		//  If we've processed all our expected messages, and there is a polling interval,
-		//  then shut down the connection.
-		if ((_bufferUsed == 0) && (_pollingInterval > 0)
-			&& (!_waitingForMessages))
-		{
-			_client.stop();
-		}
+	_ipHotTub = IPAddress(_cache._address[0], _cache._address[1], _cache._address[2],
+						  _cache._address[3]);
 
+	//  If the connect fails, ConnectFinished() starts discovery.
+	_tryingCache = true;
 
-		//  If  we are not receiving messages, then close the connection to reset it.
-		if (_client.connected())
-		{
-			if (((millis() - _lastMessageTime) > 5000))
-			{
-				Serial.println(F("Message timeout!"));
+	Reconnect();
 
-				_client.stop();
-				return _changes;
-			}
-		}
-	}
-	else
+	if (!_client.connected() && !_connecting)
 	{
-		if (_pollingInterval > 0)
-		{
+		return _searching;
+	}
 
-			if ((millis() - _lastMessageTime) > _pollingInterval)
-			{
-				//	Oh hey, it's been a while, maybe see what the hot-tub is doing these
-				//	days...
-				Reconnect();
-			}
+	//  The version has the signature, which tells us if the rest is still good.
+	SendControlConfigRequest();
 
-			if ((millis() - _lastMessageTime) > _pollingInterval * 2)
-			{
-				//  WHY WON'T YOU ANSWER MY CALLS????
-				//  Assume we've completely lost contact, need to reset.
-				ResetInfo();
-			}
+	return true;
+}
 
-		}
-		else
-		{
-			Reconnect();
-		}
+
+void
+BalBoa::BalBoaSpa::OnInfoReceived(unsigned int changes)
+{
+	if (!_useCache)
+	{
+		return;
 	}
 
-	if (_bufferUsed != 0)
+	if ((changes & scVersion) && _cacheValid
+		&& (Version()._signature != _cache._version._signature))
 	{
-		Serial.println(F("More message needed!"));
+		//  Spa has been re-configured, the cached filter times may be wrong too.
+		BALBOA_LOG_INFO(F("Spa signature changed"));
+
+		_cacheValid = false;
+		SendConfigRequest();
+		SendFilterConfigRequest();
 	}
 
-	return _changes;
+	SaveCache();
 }
 
 
-const BalBoa::SpaTime &
-BalBoa::BalBoaSpa::GetSpaTime() const
+void
+BalBoa::BalBoaSpa::SaveCache()
 {
-	_changes &= ~scTime;
+	//  Wait until there's a complete, consistent set.  The filter request isn't sent
+	//  until the first status, so not waiting for it doesn't mean it's arrived.
+	if ((Version()._signature == 0xFFFFFFFF) || (_waitingForMessages & wfmFilter)
+		|| (Filters()._filter1.stStart.hour == UNKNOWN_VAL))
+	{
+		return;
+	}
 
-	return _time;
-}
+	SpaCacheRecord record;
 
+	//  Padding too, so records can be compared with memcmp().
+	memset(&record, 0, sizeof(record));
 
-const BalBoa::SpaTemp &
-BalBoa::BalBoaSpa::GetSpaTemp() const
-{
-	_changes &= ~scTemp;
+	for (auto i = 0; i < 4; i++)
+	{
+		record._address[i] = _ipHotTub[i];
+	}
 
-	return _currentTemp;
-}
+	const VersionInfo &version = Version();
 
+	record._version._currentSetup = version._currentSetup;
+	memcpy(record._version._version, version._version, sizeof(version._version));
+	record._version._signature = version._signature;
+	memcpy(record._version._name, version._name, sizeof(version._name));
 
-const BalBoa::SpaTemp &
-BalBoa::BalBoaSpa::GetSetTemp() const
-{
-	_changes &= ~scSetPoint;
+	record._filters = Filters();
 
-	return _setPoint;
-}
+	if (_cacheValid && (memcmp(&record, &_cache, sizeof(record)) == 0))
+	{
+		return;
+	}
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsRecirc() const
-{
-	_changes &= ~scRecirc;
+	SaveSpaCache(record);
 
-	return _recirc;
+	_cache = record;
+	_cacheValid = true;
 }
+#endif
 
-BalBoa::PumpSpeed
-BalBoa::BalBoaSpa::GetPump1Speed() const
-{
-	_changes &= ~scPump1;
 
-	return _pump1Speed;
+bool
+BalBoa::BalBoaSpa::spaLocated() const
+{
+	return _ipHotTub != INADDR_NONE;
 }
 
 
-BalBoa::PumpSpeed
-BalBoa::BalBoaSpa::GetPump2Speed() const
+BalBoa::BalBoaSpa::operator bool() const
 {
-	_changes &= ~scPump2;
-
-	return _pump2Speed;
+	return spaLocated();
 }
 
 
-
-const BalBoa::FilterInfo &
-BalBoa::BalBoaSpa::GetFilterInfo() const
+void
+BalBoa::BalBoaSpa::disconnect()
 {
-	_changes &= ~scFilterTimes;
-
-	//  Make sure we have the latest time format.
-	_filters._filter1.stStart.displayAs24Hr = _time.displayAs24Hr;
-	_filters._filter2.stStart.displayAs24Hr = _time.displayAs24Hr;
-
-	return _filters;
+	_client.stop();
+	_connecting = false;
 }
 
-BalBoa::RunningFilter
-BalBoa::BalBoaSpa::GetRunningFilter() const
-{
-	_changes &= ~scFilterRunning;
 
-	BalBoa::RunningFilter rf = rfNone;
+BalBoa::SpaStatus
+BalBoa::BalBoaSpa::GetStatus()
+{
+	if (_searching)
+	{
+		return ssSearching;
+	}
 
-	if (_filter1Running == tsTrue)
+	if (!spaLocated())
 	{
-		rf = rf1;
+		return ssIdle;
 	}
-	else if (_filter2Running == tsTrue)
+
+	if (_connecting)
 	{
-		rf = rf2;
+		return ssConnecting;
 	}
 
-	return rf;
+	return _client.connected() ? ssConnected : ssDisconnected;
 }
 
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsTimeUnset() const
+const IPAddress &
+BalBoa::BalBoaSpa::GetSpaIP()
 {
-	return _timeUnset;
+	return _ipHotTub;
 }
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsHeating() const
-{
-	_changes &= ~scHeating;
-
-	return _heating;
-}
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsLightOn() const
+unsigned long
+BalBoa::BalBoaSpa::getPollingInterval()
 {
-	_changes &= ~scLights;
-
-	return _lights;
+	return _pollingInterval;
 }
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsHighRange() const
+void
+BalBoa::BalBoaSpa::setPollingInterval(
+	unsigned long seconds)
 {
-	return _rangeHigh;
+	_pollingInterval = seconds;
 }
 
 
-const BalBoa::VersionInfo &
-BalBoa::BalBoaSpa::GetVersion() const
+unsigned long
+BalBoa::BalBoaSpa::PollingInterval() const
 {
-	_changes &= ~scVersion;
-
-	return _version;
-}
-
+	if (_pollingInterval == ADAPTIVE_POLLING)
+	{
+		return _scheduler.Interval(millis());
+	}
 
-uint8_t
-BalBoa::BalBoaSpa::GetPanelMessages() const
-{
-	_changes &= ~scPanelMessages;
-	return _messages;
+	return _pollingInterval;
 }
 
 
-BalBoa::TriState
-BalBoa::BalBoaSpa::IsPriming() const
+bool
+BalBoa::BalBoaSpa::KeepConnected() const
 {
-	_changes &= ~scPriming;
+	if (_pollingInterval == ADAPTIVE_POLLING)
+	{
+		return _scheduler.HoldConnection();
+	}
 
-	return _priming;
+	return _pollingInterval == 0;
 }
 
 
 void
-BalBoa::BalBoaSpa::SetTime(
-	const BalBoa::SpaTime &time)
+BalBoa::BalBoaSpa::UpdateSchedule(unsigned long us, unsigned long frames)
 {
-	SetSpaTime newTime(time);
+	const unsigned long now = millis();
+
+	_receiveUs += us;
+	_receiveFrames += frames;
 
-	//  Mark current time as unknown to force update.
-	_time.hour = UNKNOWN_VAL;
-	_time.minute = UNKNOWN_VAL;
+	if (frames)
+	{
+		_scheduler.Observe(ChangesSince(_pollCursor), Active(), now);
+	}
 
-	SendMessage(&newTime);
+	//  Holding the connection, keep the measurements coming.
+	if ((now - _receiveStart) >= 10000)
+	{
+		ReportReceiveCost(now);
+	}
 }
 
 
 void
-BalBoa::BalBoaSpa::ToggleLights()
+BalBoa::BalBoaSpa::ReportReceiveCost(unsigned long now)
 {
-	ToggleItemMessage message(BalBoa::tiLights);
+	_scheduler.FramesCost(_receiveUs, _receiveFrames, now - _receiveStart);
 
-	SendMessage(&message);
+	_receiveStart = now;
+	_receiveUs = 0;
+	_receiveFrames = 0;
 }
 
+
 void
-BalBoa::BalBoaSpa::TogglePump1()
+BalBoa::BalBoaSpa::SendMessage(
+	BalBoa::MessageBase *pMessage)
 {
-	ToggleItemMessage message(BalBoa::tiPump1);
+	pMessage->SetCRC();
 
+	if (pMessage->IsUserCommand())
+	{
+		_scheduler.CommandSent(millis());
 
-	SendMessage(&message);
-}
+		//  Someone's waiting, try now rather than when the back off is over.
+		_reconnect.Now();
+	}
 
+	if (!_queue.Add(pMessage))
+	{
+		BALBOA_LOG_WARN(F("Command queue full!"));
+	}
 
-void
-BalBoa::BalBoaSpa::TogglePump2()
-{
-	ToggleItemMessage message(BalBoa::tiPump2);
+	if (!_client.connected())
+	{
+		//  Sends the queue once connected.
+		Reconnect();
+		return;
+	}
 
-	SendMessage(&message);
+	SendQueued();
 }
 
 
 void
-BalBoa::BalBoaSpa::ToggleTempRange()
+BalBoa::BalBoaSpa::SendQueued()
 {
-	ToggleItemMessage message(BalBoa::tiTempRange);
+	if (!_queue.Count())
+	{
+		return;
+	}
 
-	SendMessage(&message);
+	const byte tokens = _sendTokens.Available();
+
+	if (!tokens)
+	{
+		return;
+	}
+
+	//  Everything ready now goes in one write.
+	byte buffer[BALBOA_SEND_BURST * CommandQueue::maxMessageLength];
+	const byte count = min(tokens, _queue.Count());
+	const size_t size = _queue.Take(count, buffer);
+
+	_sendTokens.Use(count);
+
+	_client.write(buffer, size);
 }
 
 
-void
-BalBoa::BalBoaSpa::ToggleTempScale()
+unsigned int BalBoa::BalBoaSpa::GetChanges()
 {
-	if (_tempCelsius != tsUnknown)
+	if (_searching)
 	{
-		SetSpaTempScaleMessage message(!(bool)_tempCelsius);
+		PollDiscovery();
+		return _changes;
+	}
 
-		SendMessage(&message);
+	if (_connecting)
+	{
+		PollConnect();
+
+		if (_connecting)
+		{
+			return _changes;
+		}
 	}
-}
 
-void
-BalBoa::BalBoaSpa::SetTemp(
-	const BalBoa::SpaTemp &temp)
-{
-	SetSpaTempMessage message(temp);
+	//  Sends again anything the spa hasn't acted on, reconnecting if needed.
+	CheckCommands();
 
-	SendMessage(&message);
-}
+	// Process incoming messages
+	if (_client.connected())
+	{
+		const bool adaptive = (_pollingInterval == ADAPTIVE_POLLING);
+		const unsigned long receiveStart = adaptive ? micros() : 0;
+		const unsigned long frames = GetDecoder().Frames();
+
+		if (!ReceiveFrom(_client))
+		{
+			BALBOA_TRACE(teReadError, 0);
+			BALBOA_LOG_ERROR(F("read() error!"));
 
+			_client.stop();
+			return _changes;
+		}
 
-byte previousStatusMessage[sizeof(BalBoa::StatusMessage)];
+		if (adaptive)
+		{
+			UpdateSchedule(micros() - receiveStart, GetDecoder().Frames() - frames);
+		}
 
+		SendQueued();
 
-void
-BalBoa::BalBoaSpa::CrackStatusMessage(const byte *_messageBuffer)
-{
-	const StatusMessage *pMessage = reinterpret_cast<const StatusMessage *>(_messageBuffer);
+		//  If we've processed all our expected messages, sent all our commands and seen
+		//  them take effect, and there is a polling interval, then shut down the
+		//  connection.
+		if (!ReceivePending() && !KeepConnected()
+			&& (!_waitingForMessages) && !_queue.Count() && !CommandsPending())
+		{
+			BALBOA_TRACE(teDisconnect, 0);
 
+			const unsigned long stopStart = micros();
 
-	// Only mark this off if something changed.
-	// _waitingForMessages &= ~wfmStatus;
+			_client.stop();
 
-	unsigned int newChanges = 0;
+			if (adaptive)
+			{
+				_handshakeUs += micros() - stopStart;
 
-	if (pMessage->_hour != _time.hour)
-	{
-		_time.hour = pMessage->_hour;
-		newChanges |= scTime;
-	}
+				ReportReceiveCost(millis());
+				_scheduler.Polled(millis());
+			}
+		}
+
+
+		//  If the spa has gone quiet for longer than its cadence allows (see
+		//  BalBoaLink.h), close the connection and start again.
+		if (_client.connected() && (GetLinkState() == lsDead))
+		{
+			BALBOA_TRACE(teTimeout, 0);
+			BALBOA_LOG_ERROR(F("Message timeout!"));
+
+			_client.stop();
+			_linkLost = true;
 
-	if (pMessage->_minute != _time.minute)
+			if (LinkFailed())
+			{
+				//  WHY WON'T YOU ANSWER MY CALLS????
+				//  Assume we've completely lost contact, need to reset.
+				ResetInfo();
+			}
+			return _changes;
+		}
+	}
+	else
 	{
-		_time.minute = pMessage->_minute;
-		newChanges |= scTime;
+		if (KeepConnected() || _linkLost)
+		{
+			Reconnect();
+		}
+		else if ((millis() - _lastMessageTime) > PollingInterval())
+		{
+			//	Oh hey, it's been a while, maybe see what the hot-tub is doing these
+			//	days...
+			Reconnect();
+		}
 	}
 
-	if (pMessage->_24hrTime != _time.displayAs24Hr)
+	if (ReceivePending())
 	{
-		_time.displayAs24Hr = pMessage->_24hrTime;
-		newChanges |= scTime;
-		newChanges |= scFilterTimes;  //  Because time format has changed.
+		BALBOA_LOG_DEBUG(F("More message needed!"));
 	}
 
-	if (pMessage->_timeUnset != _timeUnset)
+	return _changes;
+}
+
+
+void
+BalBoa::BalBoaSpa::Reconnect()
+{
+	if (_connecting || !spaLocated() || _client.connected())
 	{
-		_timeUnset = static_cast<TriState>(pMessage->_timeUnset);
-		newChanges |= scTime;
+		return;
 	}
 
-	if (pMessage->_currentTemp != _currentTemp.temp)
+	if (!_reconnect.Ready(millis()))
 	{
-		_currentTemp.temp = pMessage->_currentTemp;
-		_currentTemp.isCelsiusX2 = pMessage->_tempScaleCelsius;
-
-		newChanges |= scTemp;
+		return;
 	}
 
+	BALBOA_LOG_DEBUG(F("Reconnecting to spa"));
 
-	if (pMessage->_setTemp != _setPoint.temp)
-	{
-		_setPoint.temp = pMessage->_setTemp;
-		_setPoint.isCelsiusX2 = pMessage->_tempScaleCelsius;
-
-		newChanges |= scSetPoint;
-	}
+	_connectTime = millis();
+	_reconnect.Attempt(_connectTime);
+	_handshakeStart = micros();
 
+#if BALBOA_ASYNC_CONNECT
+	int result = _client.connectStart(_ipHotTub, _comPort);
 
-	if (static_cast<TriState>(pMessage->_tempRange) != _rangeHigh)
+	if (result == 0)
 	{
-		_rangeHigh = static_cast<TriState>(pMessage->_tempRange);
-		newChanges |= scSetPoint;
+		_connecting = true;
+		_handshakeUs += micros() - _handshakeStart;
+		return;
 	}
 
-	if (static_cast<TriState>(pMessage->_tempScaleCelsius) != _tempCelsius)
+	ConnectFinished(result > 0);
+#else
+	unsigned long timeout = _connectionTimeout;
+
+	if (timeout > BALBOA_BLOCKING_CONNECT_TIMEOUT)
 	{
-		_tempCelsius = static_cast<TriState>(pMessage->_tempScaleCelsius);
-		newChanges |= (scTemp | scSetPoint);
+		timeout = BALBOA_BLOCKING_CONNECT_TIMEOUT;
 	}
 
-	if (pMessage->_pump1 != _pump1Speed)
-	{
-		_pump1Speed = static_cast<BalBoa::PumpSpeed>(pMessage->_pump1);
+	ConnectFinished(ConnectClient(_client, _ipHotTub, _comPort, timeout));
+#endif
+}
 
-		newChanges |= scPump1;
-	}
 
-	if (pMessage->_pump2 != _pump2Speed)
-	{
-		_pump2Speed = static_cast<BalBoa::PumpSpeed>(pMessage->_pump2);
+void
+BalBoa::BalBoaSpa::PollConnect()
+{
+#if BALBOA_ASYNC_CONNECT
+	_handshakeStart = micros();
 
-		newChanges |= scPump2;
-	}
+	int result = _client.connectPoll();
 
-	if (static_cast<TriState>(pMessage->_light != 0) != _lights)
+	if ((result == 0) && ((millis() - _connectTime) < _connectionTimeout))
 	{
-		_lights = static_cast<TriState>(pMessage->_light != 0);
-		newChanges |= scLights;
+		_handshakeUs += micros() - _handshakeStart;
+		return;
 	}
 
-	if (static_cast<TriState>(pMessage->_heating != 0) != _heating)
-	{
-		_heating = static_cast<TriState>(pMessage->_heating != 0);
-		newChanges |= scHeating;
-	}
+	ConnectFinished(result > 0);
+#endif
+}
 
-	if (static_cast<TriState>(pMessage->_circPump != 0) != _recirc)
-	{
-		_recirc = static_cast<TriState>(pMessage->_circPump != 0);
-		newChanges |= scRecirc;
-	}
 
-	if (static_cast<TriState>(pMessage->_filter1Running != 0) != _filter1Running)
-	{
-		_filter1Running = static_cast<TriState>(pMessage->_filter1Running != 0);
-		newChanges |= scFilterRunning;
-	}
+void
+BalBoa::BalBoaSpa::ConnectFinished(bool connected)
+{
+	_connecting = false;
 
-	if (static_cast<TriState>(pMessage->_filter2Running != 0) != _filter2Running)
-	{
-		_filter2Running = static_cast<TriState>(pMessage->_filter2Running != 0);
-		newChanges |= scFilterRunning;
-	}
+	//  Failed attempts count towards the next successful one.
+	_handshakeUs += micros() - _handshakeStart;
 
-	if (pMessage->_panelMessage != _messages)
+#if BALBOA_CACHE
+	if (connected)
 	{
-		_messages = pMessage->_panelMessage;
-		newChanges |= scPanelMessages;
+		_tryingCache = false;
 	}
+#endif
 
-	if (static_cast<TriState>(pMessage->_priming != 0) != _priming)
+	if (connected)
 	{
-		_priming = static_cast<TriState>(pMessage->_priming != 0);
-		newChanges |= scPriming;
-	}
+		BALBOA_TRACE(teConnect, 0);
 
-	if (newChanges)
-	{
-		_waitingForMessages &= ~wfmStatus;
+		_reconnect.Reset();
+		_linkLost = false;
 
-		_changes |= newChanges;
-	}
+		_scheduler.HandshakeCost(_handshakeUs);
+		_handshakeUs = 0;
+		_receiveStart = millis();
+		_receiveUs = 0;
+		_receiveFrames = 0;
 
-	//  Look to see how the 'unknown' areas change, maybe we can figure some more stuff
-	//  out.  
-	//
-	StatusMessage *pMess = const_cast<StatusMessage *>(pMessage);
+		OnConnected();
+		SendQueued();
+	}
+	else
+	{
+		BALBOA_TRACE(teConnectFailed, 0);
 
-	//  Blank out the bits we know about.
-	pMess->_priming = 0;
-	pMess->_currentTemp = 0;
-	pMess->_hour = 0;
-	pMess->_minute = 0;
-	pMess->_heatingMode = 0;
-	pMess->_tempScaleCelsius = 0;
-	pMess->_panelMessage &= 0b11110001;
-	pMess->_24hrTime = 0;
-	pMess->_tempRange = 0;
-	pMess->_timeUnset = 0;
-	pMess->_heating = 0;
-	pMess->_pump1 = 0;
-	pMess->_pump2 = 0;
-	pMess->_circPump = 0;
-	pMess->_light = 0;
-	pMess->_setTemp = 0;
-	pMess->_suffix._check = 0;
+		_reconnect.Failed();
+		_client.stop();
 
-	//  Look for changes
-	if (memcmp(pMess, previousStatusMessage, sizeof(StatusMessage)) != 0)
-	{
-		Serial.print(_time.hour), Serial.print(':'), Serial.println(_time.minute);
+		//  Better to lose them than to have them happen at some random time later.
+		_queue.Clear();
 
-		StatusMessage M;
-		memcpy(&M, previousStatusMessage, sizeof(StatusMessage));
+		if (LinkFailed())
+		{
+			ResetInfo();
+		}
 
-		M.Dump();
-		pMess->Dump();
+#if BALBOA_CACHE
+		if (_tryingCache)
+		{
+			BALBOA_LOG_INFO(F("No spa at cached address"));
 
-		memcpy(previousStatusMessage, pMess, sizeof(StatusMessage));
+			_tryingCache = false;
+			_ipHotTub = INADDR_NONE;
+			StartDiscovery();
+		}
+#endif
 	}
 }
 
 
 void
-BalBoa::BalBoaSpa::CrackConfigMessage(const byte *_messageBuffer)
+BalBoa::BalBoaSpa::ResetInfo()
 {
-	_waitingForMessages &= ~wfmConfig;
+	BALBOA_LOG_DEBUG(F("Spa Data Reset!"));
+	_client.stop();
+	_connecting = false;
+	_linkLost = false;
+
+	ResetState();
+	_scheduler.Reset(millis());
+	_handshakeUs = 0;
 }
 
 
-void
-BalBoa::BalBoaSpa::CrackFilterMessage(const byte *_messageBuffer)
+BalBoa::BalBoaSpaPool::BalBoaSpaPool(
+	BalBoa::BalBoaSpa *pSpas,
+	size_t capacity)
+	: _pSpas(pSpas), _capacity(capacity), _count(0), _pollingInterval(60000),
+	  _connectionTimeout(5000), _udpOpen(false), _searching(false), _windowStart(0),
+	  _discoveryWindow(0),
+	  _discovery(BalBoaSpa::_discoveryRetryMin, BalBoaSpa::_discoveryRetryMax)
 {
-	const FilterStatusMessage *pMessage = (const FilterStatusMessage *)_messageBuffer;
+}
 
-	_filters._filter1.stStart.hour = pMessage->filter1StartHour;
-	_filters._filter1.stStart.minute = pMessage->filter1StartMinute;
-	_filters._filter1.stStart.displayAs24Hr = _time.displayAs24Hr;
-	_filters._filter1.stDuration.hour = pMessage->filter1DurationHours;
-	_filters._filter1.stDuration.minute = pMessage->filter1DurationMinutes;
-	_filters._filter1.stDuration.displayAs24Hr = true;
 
-	_filters._filter2Enabled = pMessage->filter2enabled;
-	_filters._filter2.stStart.hour = pMessage->filter2StartHour;
-	_filters._filter2.stStart.minute = pMessage->filter2StartMinute;
-	_filters._filter2.stStart.displayAs24Hr = _time.displayAs24Hr;
-	_filters._filter2.stDuration.hour = pMessage->filter2DurationHours;
-	_filters._filter2.stDuration.minute = pMessage->filter2DurationMinutes;
-	_filters._filter2.stDuration.displayAs24Hr = true;
+bool
+BalBoa::BalBoaSpaPool::begin(
+	unsigned long pollingInterval,
+	unsigned long connectionTimeout,
+	unsigned long discoveryWindow)
+{
+	_pollingInterval = pollingInterval;
+	_connectionTimeout = connectionTimeout;
+	_discoveryWindow = discoveryWindow;
+
+	_searching = true;
+	_windowStart = millis();
+	_discovery.Reset();
+	_discovery.Attempt(_windowStart);
+	_discovery.Failed();
 
-	_changes |= scFilterTimes;
+	BALBOA_TRACE(teDiscoverySent, _discovery.Wait());
 
-	_waitingForMessages &= ~wfmFilter;
+	return BroadcastDiscovery(_udp, _udpOpen, BalBoaSpa::_discoveryPort);
 }
 
 
-void
-BalBoa::BalBoaSpa::CrackVersionMessage(const byte *_messageBuffer)
+size_t
+BalBoa::BalBoaSpaPool::Poll()
 {
-	const ControlConfigResponse *pMessage = (const ControlConfigResponse *)_messageBuffer;
+	if (_searching)
+	{
+		PollDiscovery();
+	}
 
-	_version._currentSetup = pMessage->_currentSetup;
+	size_t changed = 0;
 
-	for (auto i = 0; i < 3; i++)
+	for (size_t i = 0; i < _count; i++)
 	{
-		_version._version[i] = pMessage->_version[i];
+		if (_pSpas[i].GetChanges())
+		{
+			changed++;
+		}
 	}
 
-	_version._signature = pMessage->_signature;
+	return changed;
+}
 
-	memcpy(_version._name, pMessage->_name, sizeof(pMessage->_name));
-	_version._name[8] = '\0';
 
-	_changes |= scVersion;
+size_t
+BalBoa::BalBoaSpaPool::Find(const IPAddress &spa) const
+{
+	for (size_t i = 0; i < _count; i++)
+	{
+		if (_pSpas[i]._ipHotTub == spa)
+		{
+			return i;
+		}
+	}
 
-	_waitingForMessages &= ~wfmControlConfig;
+	return _count;
 }
 
 
 void
-BalBoa::BalBoaSpa::Reconnect()
+BalBoa::BalBoaSpaPool::PollDiscovery()
 {
-	if (!_client.connected() && spaLocated())
+	if (_udpOpen)
 	{
-
-		//Serial.println(F("Reconnecting to spa"));
-		if (_client.connect(_ipHotTub, _comPort))
+		//  Everything that's arrived, each spa answers every broadcast.
+		for (IPAddress spa = ReadDiscoveryAnswer(_udp); spa != INADDR_NONE;
+			 spa = ReadDiscoveryAnswer(_udp))
 		{
-			_lastMessageTime = millis();
-
-			_bufferUsed = 0;
-
-			//  Once we re-connect, see if there are messages we are expecting.  If so,
-			//  resend the request.
-			auto oldWaiting = _waitingForMessages;
-
-			//  We *always* want a status message when we connect.
-			_waitingForMessages = wfmStatus;
-
-			if (oldWaiting & wfmConfig)
-			{
-				SendConfigRequest();
-			}
-
-			if (oldWaiting & wfmFilter)
+			if (Find(spa) == _count)
 			{
-				SendFilterConfigRequest();
-			}
-
-			if (oldWaiting & wfmControlConfig)
-			{
-				SendControlConfigRequest();
+				AddSpa(spa);
 			}
 		}
 	}
-}
 
-void
-BalBoa::BalBoaSpa::ResetInfo()
-{
-	// Serial.println(F("Spa Data Reset!"));
-	_client.stop();
-
-	_lastMessageTime = millis();
+	const unsigned long now = millis();
 
-	//  If we had valid data, mark everything as changed.
-	if (_time.hour != UNKNOWN_VAL)
+	if ((now - _windowStart) >= _discoveryWindow)
 	{
-		_changes = SpaChanges::scMASK;
+		BALBOA_LOG_DEBUG(F("Discovery window closed"));
+
+		_udp.stop();
+		_udpOpen = false;
+		_searching = false;
+		return;
 	}
 
-	_time = {UNKNOWN_VAL, UNKNOWN_VAL, true};
-	_currentTemp = {UNKNOWN_VAL, false};
-	_setPoint = {UNKNOWN_VAL, false};
-	_rangeHigh = tsUnknown;
-	_tempCelsius = tsUnknown;
-	_pump1Speed = psUNKNOWN;
-	_pump2Speed = psUNKNOWN;
-	_recirc = tsUnknown;
-	_timeUnset = tsUnknown;
-	_lights = tsUnknown;
-	_heating = tsUnknown;
-	_filter1Running = tsUnknown;
-	_filter2Running = tsUnknown;
+	//  Broadcasts get lost, and spas may still be starting up.
+	if (_discovery.Ready(now))
+	{
+		_discovery.Attempt(now);
+		_discovery.Failed();
 
-	// _ipHotTub = INADDR_NONE;
+		BALBOA_TRACE(teDiscoverySent, _discovery.Wait());
 
-	_filters = {{{UNKNOWN_VAL, UNKNOWN_VAL, true}, {UNKNOWN_VAL, UNKNOWN_VAL, true}},
-	{{UNKNOWN_VAL, UNKNOWN_VAL, true}, {UNKNOWN_VAL, UNKNOWN_VAL, true}}, true};
+		BroadcastDiscovery(_udp, _udpOpen, BalBoaSpa::_discoveryPort);
+	}
+}
 
 
-	_version = {UNKNOWN_VAL, {UNKNOWN_VAL, UNKNOWN_VAL, UNKNOWN_VAL}, 0xFFFFFFFF, {'\0'}};
+void
+BalBoa::BalBoaSpaPool::AddSpa(const IPAddress &spa)
+{
+	if (_count == _capacity)
+	{
+		BALBOA_LOG_WARN(F("Spa pool full!"));
+		return;
+	}
 
-	_messages = pmNone;
+	_pSpas[_count++].begin(spa, _pollingInterval, _connectionTimeout);
 }
 
+#endif
@@ -1,15 +1,13 @@
+//  Public interface to the BalBoa spa library.
+//
+//  SpaProtocol is the protocol engine:  it decodes the spa's messages, tracks the spa state
+//  and builds commands, but does no I/O of its own.  BalBoaSpa adds discovery and the TCP
+//  connection using the platform classes chosen in BalBoaPlatform.h.
 
+#ifndef _BALBOASPA_h
+#define _BALBOASPA_h
 
-//  Try to determine the connection type we have based on what headers have been included.
-#if defined WiFi_h
-
-typedef WiFiClient SpaClient;
-#define ETHERNET_INCLUDED 1
-#elif defined ethernet_h_
-#define ETHERNET_INCLUDED 1
-
-typedef EthernetClient SpaClient;
-#endif
+#include "BalBoaPlatform.h"
 
 namespace BalBoa
 {
@@ -103,6 +101,45 @@ namespace BalBoa
 		char _name[9];
 	};
 
+	//  Everything known about the spa at one moment, see SpaProtocol::GetState().
+	struct SpaState
+	{
+		uint32_t updates;   //  Goes up by one each time anything changes
+		SpaTime time;
+		SpaTemp currentTemp;
+		SpaTemp setPoint;
+		TriState highRange;
+		TriState celsius;
+		PumpSpeed pump1;
+		PumpSpeed pump2;
+		TriState recirc;
+		TriState timeUnset;
+		TriState heating;
+		TriState lights;
+		TriState priming;
+		uint8_t panelMessages;
+		RunningFilter runningFilter;
+		FilterInfo filters;
+		VersionInfo version;
+	};
+
+	//  One consumer's place in the stream of changes, see SpaProtocol::ChangesSince().
+	//  A new (or reset) cursor sees everything as changed.
+	struct ChangeCursor
+	{
+		uint32_t seen = 0;   //  SpaState::updates when it last caught up
+	};
+
+	//  What the spa should end up like.  Anything left unknown is left alone.
+	struct SpaScene
+	{
+		TriState lights = tsUnknown;
+		PumpSpeed pump1 = psUNKNOWN;
+		PumpSpeed pump2 = psUNKNOWN;
+		TriState highRange = tsUnknown;
+		byte setTemp = UNKNOWN_VAL;   //  In the spa's current scale
+	};
+
 	enum PanelMessages  //  So far looks like only 1 is displayed at a time
 	{
 		pmNone = 0,
@@ -114,33 +151,61 @@ namespace BalBoa
 
 
 	struct MessageBase;
+}
+
+#include "BalBoaDecoder.h"
+#include "BalBoaAnalyzer.h"
+#include "BalBoaCache.h"
+#include "BalBoaQueue.h"
+#include "BalBoaCommands.h"
+#include "BalBoaSnapshot.h"
+#include "BalBoaHistory.h"
+#include "BalBoaPolling.h"
+#include "BalBoaLink.h"
 
-#if defined ETHERNET_INCLUDED
-	class BalBoaSpa
+namespace BalBoa
+{
+
+	//  Transport independent part of the library.  Feed it bytes received from the spa
+	//  with ReceiveBuffer() / Received() (or Receive()); anything it needs to send goes
+	//  through SendMessage(), which the derived class provides.
+	class SpaProtocol
 	{
 	public:
-		BalBoaSpa();
-		bool begin(unsigned long pollingInterval = 60000,   // Milli-seconds
-				   unsigned long connectionTimeout = 5000); // Milli-seconds
-		bool spaLocated() const;
-		explicit operator bool() const;   //  Returns 'true' once spa has been contacted
-		const IPAddress &GetSpaIP();
-		void disconnect();
-
-		unsigned long getPollingInterval();
-		void setPollingInterval(unsigned long pollingInterval);  //  Milli-seconds
+		SpaProtocol();
 
-		//  Call in your 'loop' function to get updates from the Spa.  Code will only
-		//  report changes that you haven't acknowledged.
-		unsigned int GetChanges(void);
+		//  Changes not yet acknowledged by calling the matching getter.
+		unsigned int Changes() const
+		{
+			return _changes;
+		};
 
 		//  Pretend everything has changed.  Would force your code to retrieve and repaint
 		//  everything, e.g. you switched to a different display screen and have just
 		//  switched back.
-		void TriggerChanges(void)
-		{
-			_changes = scMASK;
-		};
+		void TriggerChanges(void);
+
+		//  Called the moment a change is decoded, with the state just before and just
+		//  after it.  'change' is a single flag; a callback set for several flags is
+		//  called once for each that changed, in flag order.
+		typedef void (*ChangeCallback)(SpaChanges change, const SpaState &before,
+									   const SpaState &after, void *pContext);
+
+		//  Set (or with nullptr, clear) the callback for each flag in 'changes'.  Changes
+		//  handed to a callback count as acknowledged, and aren't reported by Changes() /
+		//  GetChanges().  TriggerChanges() calls every callback, with before == after.
+		//  Callbacks may send commands, but shouldn't set or clear callbacks.
+		void SetChangeCallback(unsigned int changes, ChangeCallback, void *pContext = nullptr);
+
+		//  For consumers that don't want to share the change flags above:  each keeps its
+		//  own cursor, and gets the flags changed since it last asked, without affecting
+		//  Changes() or any other cursor.  Read the values with GetState(), which doesn't
+		//  acknowledge anything either.  Same thread as GetChanges() only.
+		unsigned int ChangesSince(ChangeCursor &) const;
+
+		//  A consistent copy of everything at once.  Doesn't acknowledge any changes, and
+		//  with BALBOA_SNAPSHOT may be called from any task or core (see BalBoaSnapshot.h).
+		SpaState GetState() const;
 
 		//  Get and acknowledge changes.         // Change flag affected
 		const SpaTime &GetSpaTime() const;       // scTime
@@ -160,6 +225,34 @@ namespace BalBoa
 		TriState IsPriming() const;              // scPriming
 		void SendFilterConfigRequest();
 
+#if BALBOA_ANALYZER
+		//  What's been seen in the unknown parts of the spa's messages.
+		const ProtocolAnalyzer &GetAnalyzer() const
+		{
+			return _analyzer;
+		};
+#endif
+
+#if BALBOA_HISTORY_SIZE > 0
+		//  Temperature, heater, pumps and lights over the last day or so.
+		const StateHistory &GetHistory() const
+		{
+			return _history;
+		};
+#endif
+
+#if BALBOA_COMMAND_TRACKING
+		//  Command round trip times, retries and failures.
+		const CommandTracker &GetCommandTracker() const
+		{
+			return _commands;
+		};
+#endif
+
+		//  Whether the last command of each type has been seen to take effect.  Always
+		//  csNone without BALBOA_COMMAND_TRACKING.
+		CommandStatus GetCommandStatus(CommandType) const;
+
 		//  Calling any of these will likely cause change notifications to come back.  So,
 		//  no need to explicitly update things on the client side, the change
 		//  notifications will do that naturally.
@@ -172,28 +265,144 @@ namespace BalBoa
 
 		void SetTemp(const SpaTemp &);
 
+		//  Say where you want things to end up rather than what to toggle.  The toggles
+		//  needed are worked out from the current state and sent together; once they've
+		//  had time to take effect, it's checked and re-planned from the latest status
+		//  until the spa gets there (or BALBOA_SCENE_ROUNDS tries).  Each call adds to the
+		//  current target.  Pumps are assumed to cycle off, low, high.
+		void SetLights(bool on);
+		void SetPump(byte pump, PumpSpeed);  //  Pump 1 or 2
+		void SetTempRange(bool high);
+		void SetScene(const SpaScene &);
+
+		//  csPending until the spa matches the scene, then csConfirmed (or csFailed).
+		CommandStatus GetSceneStatus() const;
+
 		//  As yet unimplemented things
 		//  void SetFilterTimes(const FilterInfo &);
 		//  void SetSpaWiFiSettings(...);
 
+		//  Incoming data.  Write up to 'space' bytes at the returned pointer, then call
+		//  Received() with the count; complete frames are processed immediately.
+		byte *ReceiveBuffer(size_t &space);
+		void Received(size_t count);
 
-	private:
-		void Reconnect();
-		void ResetInfo();
+		//  Same, copying from a buffer.
+		void Receive(const byte *pData, size_t count);
+
+		//  Same, reading whatever is available from anything with Arduino Client style
+		//  available() and read(byte *, size_t).  Returns false on a read error.
+		template <typename Source>
+		bool ReceiveFrom(Source &source)
+		{
+			int available = source.available();
+
+			while (available > 0)
+			{
+				size_t space;
+				byte *pBuffer = ReceiveBuffer(space);
+
+				//  Docs are...  misleading.  I'm getting -1 return values on read()
+				//  sometimes.
+				int amountRead = source.read(pBuffer, min((size_t)available, space));
+
+				if (amountRead < 0)
+				{
+					return false;
+				}
+
+				Received(amountRead);
+
+				if (amountRead == 0)
+				{
+					break;
+				}
+
+				available = source.available();
+			}
+
+			return true;
+		}
+
+		//  Bytes of a partial frame are waiting for the rest.
+		bool ReceivePending() const;
+
+		//  Whether the spa's messages are arriving when expected, see BalBoaLink.h.
+		LinkState GetLinkState() const
+		{
+			return _link.Check(millis());
+		};
+		const LinkMonitor &GetLinkMonitor() const
+		{
+			return _link;
+		};
+		void SetLinkThresholds(float suspectPhi, float deadPhi)
+		{
+			_link.SetThresholds(suspectPhi, deadPhi);
+		};
+
+		//  Frame counts, good and bad.
+		const FrameDecoder &GetDecoder() const
+		{
+			return _decoder;
+		};
+
+		//  Bytes between the message ID and the check byte of a status message.
+		static constexpr byte statusPayloadLength = 24;
+
+	protected:
+		~SpaProtocol() = default;
+
+		//  Send a complete message (check byte not yet set) to the spa.
+		virtual void SendMessage(MessageBase *) = 0;
+
+		//  A new connection has been made, (re)send any outstanding requests.
+		void OnConnected();
+
+		//  Back to all 'unknown' values.
+		void ResetState();
+
+		//  Re-send commands the spa hasn't confirmed in time, and re-plan scenes.  Call
+		//  regularly.
+		void CheckCommands();
+
+		//  Commands or a scene waiting to be confirmed.
+		bool CommandsPending() const;
+
+		//  A connection attempt failed, or the link died (GetLinkState()).  True once the
+		//  spa should be taken as lost.
+		bool LinkFailed()
+		{
+			return _link.Failed();
+		};
 
 		void SendConfigRequest();
 		void SendControlConfigRequest();
 
-		void SendMessage(MessageBase *);
+		//  Version (scVersion) or filter (scFilterTimes) info has arrived from the spa.
+		virtual void OnInfoReceived(unsigned int)
+		{};
 
-		void CrackStatusMessage(const byte *);
-		void CrackConfigMessage(const byte *);
-		void CrackFilterMessage(const byte *);
-		void CrackVersionMessage(const byte *);
+		//  The heater, a pump or priming is on.
+		bool Active() const;
 
-		typedef uint16_t portNum;
-		static constexpr portNum _discoveryPort = 30303;
-		static constexpr portNum _comPort = 4257;
+		//  Decode a status payload, without the framing around it.  'full' decodes every
+		//  field, rather than only those that differ from the last status:  for measuring
+		//  what that saves.
+		void DecodeStatus(const byte *pPayload, bool full);
+
+		//  Version and filter info from elsewhere (a cache), reported as changes.
+		void RestoreInfo(const VersionInfo &, const FilterInfo &);
+
+		//  Without acknowledging any changes.
+		const VersionInfo &Version() const
+		{
+			return _version;
+		};
+		const FilterInfo &Filters() const
+		{
+			return _filters;
+		};
 
 		//  When polling, messages to wait for before disconnecting
 		enum waitForMessage : byte
@@ -204,18 +413,104 @@ namespace BalBoa
 			wfmConfig = 0x08
 		};
 
-		IPAddress _ipHotTub;
-		SpaClient _client;
-
-		unsigned long _pollingInterval;
 		unsigned long _lastMessageTime;
 		byte _waitingForMessages;
-		static constexpr int _maxMessageLength = 40;
-		byte _bufferUsed = 0;
-		byte _messageBuffer[_maxMessageLength];
 
 		mutable unsigned int _changes;
 
+	private:
+		void ProcessMessage(const MessageBase *);
+
+		//  Handlers for each message from the spa, as listed in BALBOA_SPA_MESSAGES.  Each
+		//  is given the payload, at least as long as its fields need.
+		typedef void (SpaProtocol::*MessageHandler)(const byte *pPayload);
+
+		struct Dispatch
+		{
+			MessageHandler handler;
+			byte length;   //  Shortest payload
+		};
+
+		//  In PROGMEM, indexed by SpaMessageIndex.
+		static const Dispatch _dispatch[];
+
+		void StatusArrived(const byte *);
+		void CrackStatusMessage(const byte *);
+		void CrackConfigMessage(const byte *);
+		void CrackFilterMessage(const byte *);
+		void CrackVersionMessage(const byte *);
+		void IgnoreMessage(const byte *)
+		{};
+
+		//  Something in the state has changed, stamp the fields and publish it for GetState().
+		void StateChanged(unsigned int changes);
+
+		//  Changes to acknowledge for the callbacks, and whether to save the 'before' state.
+		unsigned int Unhandled(unsigned int changes) const
+		{
+			return changes & ~_handledChanges;
+		};
+		bool SaveState(SpaState &) const;
+		void CallCallbacks(unsigned int changes, const SpaState &before);
+		void BuildState(SpaState &) const;
+		RunningFilter CurrentFilter() const;
+		void RecordHistory();
+
+		//  What a command of this type would change, as CommandTracker sees it.
+		uint16_t CommandValue(CommandType) const;
+		void TrackCommand(CommandType, const MessageBase *, uint16_t expected, bool expectChange);
+		void TrackToggle(CommandType, const MessageBase *);
+
+		//  Send what's needed to reach _scene.  Until the last batch has had time to take
+		//  effect, only with 'now', and counting on that batch.
+		void PlanScene(bool now);
+		bool SceneReached() const;
+
+		//  Commands a scene sends, still waiting for the tracker to confirm them.
+		bool SceneCommandsPending() const;
+
+		SpaScene _scene;
+		SpaScene _sceneSent;   //  What the last batch(es) should leave things at
+		CommandStatus _sceneStatus;
+		byte _sceneRounds;
+		unsigned long _scenePlanned;
+
+		FrameDecoder _decoder;
+		LinkMonitor _link;
+
+		//  Payload of the last status message, to skip decoding when it hasn't changed.
+		bool _haveLastStatus;
+		byte _lastStatus[statusPayloadLength];
+#if BALBOA_ANALYZER
+		ProtocolAnalyzer _analyzer;
+#endif
+#if BALBOA_COMMAND_TRACKING
+		CommandTracker _commands;
+#endif
+#if BALBOA_SNAPSHOT
+		StateSnapshot _snapshot;
+#endif
+#if BALBOA_HISTORY_SIZE > 0
+		StateHistory _history;
+#endif
+		uint32_t _stateUpdates;
+
+		static constexpr byte changeFlags = 13;
+		static_assert(scMASK == (1 << changeFlags) - 1, "One entry per change flag");
+
+		//  _stateUpdates when each flag last changed, for ChangesSince().
+		uint32_t _generations[changeFlags];
+
+		//  One per SpaChanges flag, no allocation.
+		struct Callback
+		{
+			ChangeCallback callback;
+			void *pContext;
+		};
+
+		Callback _callbacks[changeFlags];
+		unsigned int _handledChanges;   //  Flags with a callback
+
 		//  Current view of the Spa.  As new data comes in, it's compared to the current
 		//  view, and if different updated and change notifications set.
 		SpaTime            _time;
@@ -236,5 +531,211 @@ namespace BalBoa
 		uint8_t            _messages;
 		TriState           _priming;
 	};
+
+
+#if defined BALBOA_HAVE_NETWORK
+	//  Where BalBoaSpa is in finding and talking to the spa.
+	enum SpaStatus : byte
+	{
+		ssIdle,          //  begin() hasn't been called
+		ssSearching,     //  Discovery broadcast sent, waiting for the spa to answer
+		ssConnecting,    //  TCP connection to the spa in progress
+		ssConnected,     //  Talking to the spa
+		ssDisconnected   //  Spa found, but not connected (between polls, or reconnecting)
+	};
+
+
+	//  A spa on the local network, found by UDP broadcast and talked to over TCP.
+	class BalBoaSpa : public SpaProtocol
+	{
+	public:
+		BalBoaSpa();
+
+		//  Starts looking for the spa and returns straight away, GetChanges() does the
+		//  rest.  Calling it again while still searching does nothing, so older sketches
+		//  that call it from loop() whenever !Spa keep working.
+		//
+		//  A polling interval of 0 stays connected, ADAPTIVE_POLLING picks the interval
+		//  (and whether to stay connected) from what the spa is doing, see BalBoaPolling.h.
+		//
+		//  Connecting doesn't block either where the platform supports it, otherwise it's
+		//  limited to BALBOA_BLOCKING_CONNECT_TIMEOUT (see BalBoaPlatform.h).  Commands
+		//  are queued (see BalBoaQueue.h) and sent, paced, once connected.
+		bool begin(unsigned long pollingInterval = 60000,   // Milli-seconds
+				   unsigned long connectionTimeout = 5000); // Milli-seconds (TCP connect)
+
+		//  Same, for a spa whose address is already known (e.g. from BalBoaSpaPool).  No
+		//  discovery, and the cache (BalBoaCache.h) is left alone, as it only holds one spa.
+		bool begin(const IPAddress &spa,
+				   unsigned long pollingInterval = 60000,
+				   unsigned long connectionTimeout = 5000);
+		bool spaLocated() const;
+		explicit operator bool() const;   //  Returns 'true' once spa has been contacted
+		SpaStatus GetStatus();
+		const IPAddress &GetSpaIP();
+		void disconnect();
+
+		unsigned long getPollingInterval();
+		void setPollingInterval(unsigned long pollingInterval);  //  Milli-seconds
+
+		//  What ADAPTIVE_POLLING has decided, and measured.
+		const PollScheduler &GetPollScheduler() const
+		{
+			return _scheduler;
+		};
+
+		//  Connection and discovery attempts, and how long until the next.
+		const Backoff &GetReconnectBackoff() const
+		{
+			return _reconnect;
+		};
+		const Backoff &GetDiscoveryBackoff() const
+		{
+			return _discovery;
+		};
+
+		//  Call in your 'loop' function to get updates from the Spa.  Code will only
+		//  report changes that you haven't acknowledged.
+		unsigned int GetChanges(void);
+
+	protected:
+		void SendMessage(MessageBase *) override;
+#if BALBOA_CACHE
+		void OnInfoReceived(unsigned int) override;
+#endif
+
+	private:
+		friend class BalBoaSpaPool;
+
+		void Reconnect();
+		void PollConnect();
+		void ConnectFinished(bool connected);
+		void SendQueued();
+		void ResetInfo();
+		bool StartDiscovery();
+		bool SendDiscovery();
+		void PollDiscovery();
+		void SpaFound(const IPAddress &);
+
+		//  The interval in use right now, and whether to stay connected regardless.
+		unsigned long PollingInterval() const;
+		bool KeepConnected() const;
+		void UpdateSchedule(unsigned long us, unsigned long frames);
+		void ReportReceiveCost(unsigned long now);
+#if BALBOA_CACHE
+		bool ConnectFromCache();
+		void SaveCache();
+#endif
+
+		typedef uint16_t portNum;
+		static constexpr portNum _discoveryPort = 30303;
+		static constexpr portNum _comPort = 4257;
+
+		//  Discovery broadcast is repeated, doubling the wait each time up to the max.
+		static constexpr unsigned long _discoveryRetryMin = 500;
+		static constexpr unsigned long _discoveryRetryMax = 16000;
+
+		IPAddress _ipHotTub;
+		SpaClient _client;
+
+		bool _connecting;
+		bool _linkLost;   //  Reconnect straight away, without waiting for the interval
+		unsigned long _connectTime;
+		unsigned long _connectionTimeout;
+		Backoff _reconnect;
+
+		CommandQueue _queue;
+		TokenBucket _sendTokens;
+
+		SpaUdp _udp;
+		bool _udpOpen;
+		bool _searching;
+		Backoff _discovery;
+
+#if BALBOA_CACHE
+		//  As last loaded or saved.
+		SpaCacheRecord _cache;
+		bool _cacheValid;
+		bool _tryingCache;   //  Connecting to the cached address
+		bool _useCache;      //  False when the address came from elsewhere
+#endif
+
+		unsigned long _pollingInterval;
+
+		//  For ADAPTIVE_POLLING.  Loop time spent connecting and disconnecting since the
+		//  last connection was made, and receiving since _receiveStart.
+		PollScheduler _scheduler;
+		ChangeCursor _pollCursor;
+		unsigned long _handshakeStart;
+		unsigned long _handshakeUs;
+		unsigned long _receiveStart;
+		unsigned long _receiveUs;
+		unsigned long _receiveFrames;
+	};
+
+
+	//  Many spas on one network.  Discovery collects every spa that answers within the
+	//  window (repeating the broadcast as BalBoaSpa does), and each gets its own BalBoaSpa
+	//  with its own connection, queue and changes.  Storage for the spas comes from the
+	//  caller, e.g. a global array on Arduino, or new[] / std::vector on Linux:
+	//
+	//      BalBoa::BalBoaSpa Spas[8];
+	//      BalBoa::BalBoaSpaPool Pool(Spas, 8);
+	//
+	//  Call Poll() from loop() in place of GetChanges(), then look at Changes() (and the
+	//  getters) of each spa.
+	class BalBoaSpaPool
+	{
+	public:
+		BalBoaSpaPool(BalBoaSpa *pSpas, size_t capacity);
+
+		//  Starts a discovery window and returns straight away.  Spas already in the pool
+		//  are kept, so calling it again picks up spas added since.
+		bool begin(unsigned long pollingInterval = 60000,   // Milli-seconds
+				   unsigned long connectionTimeout = 5000,  // Milli-seconds (TCP connect)
+				   unsigned long discoveryWindow = 5000);   // Milli-seconds
+
+		//  Services discovery and every spa.  Returns how many spas have changes not yet
+		//  acknowledged.
+		size_t Poll();
+
+		bool Searching() const
+		{
+			return _searching;
+		};
+
+		size_t Count() const
+		{
+			return _count;
+		};
+
+		BalBoaSpa &operator[](size_t index)
+		{
+			return _pSpas[index];
+		};
+
+		//  Index of the spa at that address, or Count() if there isn't one.
+		size_t Find(const IPAddress &) const;
+
+	private:
+		void PollDiscovery();
+		void AddSpa(const IPAddress &);
+
+		BalBoaSpa *_pSpas;
+		size_t _capacity;
+		size_t _count;
+
+		unsigned long _pollingInterval;
+		unsigned long _connectionTimeout;
+
+		SpaUdp _udp;
+		bool _udpOpen;
+		bool _searching;
+		unsigned long _windowStart;
+		unsigned long _discoveryWindow;
+		Backoff _discovery;
+	};
+#endif
+}
+
 #endif
-}
\ No newline at end of file
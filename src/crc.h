@@ -215,6 +215,11 @@ extern "C"
 #define FINAL_XOR_VALUE	0x02
 #define REVERSED_DATA   FALSE
 #define REVERSED_OUT	FALSE
+#define CHECK_VALUE     0x04
+
+//  The table for these settings is a constant, kept in flash (PROGMEM) on AVR and ESP
+//  boards, so there is nothing to build at run-time.
+#define STATIC_LOOKUPTABLE  TRUE
 
 #else
 
@@ -223,13 +228,33 @@ extern "C"
 
 #endif
 
-#if (CALCULATE_LOOKUPTABLE == FALSE)
+#ifndef STATIC_LOOKUPTABLE
+#define STATIC_LOOKUPTABLE  FALSE
+#endif
+
+//  Number of bytes consumed per step when using the static table.  Micro-controllers use
+//  the single 256 byte table, hosts can afford the extra tables for slice-by-4.
+#ifndef CRC_SLICE_BY
+#if defined(ARDUINO)
+#define CRC_SLICE_BY    1
+#else
+#define CRC_SLICE_BY    4
+#endif
+#endif
+
+#if (CALCULATE_LOOKUPTABLE == FALSE) || (STATIC_LOOKUPTABLE == TRUE)
 #define F_CRC_InicializaTabla()
 #else
 	void F_CRC_InicializaTabla(void);
 #endif
 	crc F_CRC_CalculaCheckSum(uint8_t const AF_Datos[], uint16_t VF_nBytes);
 
+#if (STATIC_LOOKUPTABLE == TRUE)
+	//  Incremental form, for data that arrives a byte at a time.  Start with
+	//  INITIAL_VALUE, and XOR the final register with FINAL_XOR_VALUE.
+	crc F_CRC_ActualizaCheckSum(crc VF_CRC, uint8_t VF_Dato);
+#endif
+
 #ifdef __cplusplus
   //extern "c"
 }